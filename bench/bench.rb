@@ -0,0 +1,175 @@
+# frozen_string_literal: true
+
+# Throughput benchmark for FastXmlReader against Nokogiri::XML::Reader and Ox.
+#
+#   bundle exec rake bench
+#
+# Environment:
+#   BENCH_MB=64       size of each generated corpus
+#   BENCH_HUGE=1      also run a 2GB single-file corpus
+#   BENCH_ONLY=fast   only run parsers whose name matches
+#   BENCH_DIR=...     where corpora are cached (default tmp/bench)
+#
+# Each case runs in a forked child so peak RSS is per case.
+
+$LOAD_PATH.unshift(File.expand_path('../lib', __dir__))
+require 'fast_xml_reader'
+require 'stringio'
+require_relative 'corpus'
+
+begin
+  require 'nokogiri'
+rescue LoadError
+  warn 'nokogiri not installed, skipping Nokogiri::XML::Reader'
+end
+
+begin
+  require 'ox'
+rescue LoadError
+  warn 'ox not installed, skipping Ox'
+end
+
+module Bench
+  MB = Corpus::MB
+
+  # Visits every node the way a typical consumer does: names of elements,
+  # values of text. Returns the node count.
+  def self.fast_consume(reader)
+    nodes = 0
+    reader.each do |n|
+      n.node_type == FastXmlReader::TYPE_TEXT ? n.value : n.name
+      nodes += 1
+    end
+    nodes
+  end
+
+  def self.nokogiri_consume(reader)
+    nodes = 0
+    reader.each do |n|
+      n.node_type == Nokogiri::XML::Reader::TYPE_TEXT ? n.value : n.name
+      nodes += 1
+    end
+    nodes
+  end
+
+  if defined?(Ox)
+    class OxCounter < ::Ox::Sax
+      attr_reader :nodes
+
+      def initialize
+        @nodes = 0
+      end
+
+      def start_element(_name)
+        @nodes += 1
+      end
+
+      def end_element(_name)
+        @nodes += 1
+      end
+
+      def text(_value)
+        @nodes += 1
+      end
+    end
+  end
+
+  def self.with_pipe(path)
+    io = IO.popen(['cat', path], 'rb')
+    yield io
+  ensure
+    io.close if io
+  end
+
+  PARSERS = {
+    'fast mmap' => ->(path) { fast_consume(FastXmlReader.new(path)) },
+    'fast stringio' => ->(path) { fast_consume(FastXmlReader.new(StringIO.new(File.binread(path)))) },
+    'fast pipe' => ->(path) { with_pipe(path) { |io| fast_consume(FastXmlReader.new(io)) } }
+  }
+
+  if defined?(Nokogiri)
+    PARSERS['nokogiri file'] = lambda do |path|
+      File.open(path, 'rb') { |f| nokogiri_consume(Nokogiri::XML::Reader(f)) }
+    end
+    PARSERS['nokogiri pipe'] = lambda do |path|
+      with_pipe(path) { |io| nokogiri_consume(Nokogiri::XML::Reader(io)) }
+    end
+  end
+
+  if defined?(Ox)
+    PARSERS['ox sax'] = lambda do |path|
+      File.open(path, 'rb') { |f| OxCounter.new.tap { |h| Ox.sax_parse(h, f) }.nodes }
+    end
+  end
+
+  def self.peak_rss_mb
+    status = File.read('/proc/self/status') rescue nil
+    hwm = status && status[/^VmHWM:\s+(\d+)/, 1]
+    hwm ? hwm.to_i / 1024.0 : nil
+  end
+
+  # Runs the block in a child process and returns its result hash.
+  def self.isolated
+    rd, wr = IO.pipe
+    pid = fork do
+      rd.close
+      wr.write(Marshal.dump(yield))
+      wr.close
+      exit!(0)
+    end
+    wr.close
+    result = Marshal.load(rd.read)
+    rd.close
+    Process.wait(pid)
+    result
+  end
+
+  def self.measure(paths, parser)
+    isolated do
+      GC.start
+      allocs = GC.stat(:total_allocated_objects)
+      t = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      nodes = paths.inject(0) { |s, p| s + parser.call(p) }
+      elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t
+      {
+        nodes: nodes,
+        seconds: elapsed,
+        allocs: GC.stat(:total_allocated_objects) - allocs,
+        rss: peak_rss_mb
+      }
+    end
+  end
+
+  def self.report(title, paths, parsers)
+    bytes = paths.inject(0) { |s, p| s + File.size(p) }
+    puts
+    puts format('%s (%d file%s, %.1f MB)', title, paths.size, paths.size == 1 ? '' : 's', bytes.to_f / MB)
+    puts format('  %-16s %10s %12s %12s %10s', 'parser', 'MB/s', 'nodes/s', 'allocs/node', 'peak RSS')
+    parsers.each do |name, parser|
+      r = measure(paths, parser)
+      puts format('  %-16s %10.1f %12.0f %12.2f %9s',
+                  name, bytes / MB.to_f / r[:seconds], r[:nodes] / r[:seconds],
+                  r[:allocs].to_f / r[:nodes], r[:rss] ? format('%.0fMB', r[:rss]) : 'n/a')
+    end
+  end
+
+  def self.run
+    size = Integer(ENV.fetch('BENCH_MB', '64')) * MB
+    only = ENV['BENCH_ONLY'] && Regexp.new(ENV['BENCH_ONLY'])
+    parsers = PARSERS.select { |name, _| only.nil? || name =~ only }
+    single = parsers.reject { |name, _| name.end_with?('stringio', 'pipe') }
+
+    puts "ruby #{RUBY_VERSION}, fast_xml_reader, corpus size #{size / MB}MB"
+    report('product feed', [Corpus.product_feed(size)], parsers)
+    report('wide attributes', [Corpus.wide_attributes(size)], single)
+    report('deep nesting', [Corpus.deep_nesting(size)], single)
+    report('entity-heavy text', [Corpus.entity_text(size)], single)
+    report('many small files', Corpus.small_files(2000, 16 * 1024), single)
+    return unless ENV['BENCH_HUGE']
+
+    report('2GB single file', [Corpus.product_feed(2048 * MB, 'huge_feed.xml')],
+           parsers.reject { |name, _| name.end_with?('stringio') })
+  end
+end
+
+Bench.run if $PROGRAM_NAME == __FILE__
@@ -0,0 +1,90 @@
+# frozen_string_literal: true
+
+require 'fileutils'
+
+# Generates benchmark corpora of different shapes. Files are cached in
+# BENCH_DIR and only rebuilt when missing or of the wrong size.
+module Corpus
+  DIR = ENV.fetch('BENCH_DIR') { File.expand_path('../tmp/bench', __dir__) }
+  MB = 1024 * 1024
+
+  module_function
+
+  # Writes records produced by the block until the file reaches bytes.
+  def generate(name, bytes, header: "<feed>\n", footer: "</feed>\n")
+    FileUtils.mkdir_p(DIR)
+    path = File.join(DIR, name)
+    return path if File.exist?(path) && File.size(path) >= bytes
+
+    File.open("#{path}.tmp", 'wb') do |f|
+      f << %(<?xml version="1.0" encoding="UTF-8"?>\n) << header
+      i = 0
+      buf = String.new
+      while f.pos < bytes
+        buf.clear
+        while buf.bytesize < 64 * 1024 && f.pos + buf.bytesize < bytes
+          buf << yield(i)
+          i += 1
+        end
+        f.write(buf)
+      end
+      f.write(footer)
+    end
+    File.rename("#{path}.tmp", path)
+    path
+  end
+
+  def wide_attributes(bytes)
+    generate('wide_attributes.xml', bytes) do |i|
+      attrs = (0...40).map { |a| %(c#{a}="#{(i * 31 + a) % 997}") }.join(' ')
+      %(  <row id="#{i}" #{attrs}/>\n)
+    end
+  end
+
+  def deep_nesting(bytes)
+    generate('deep_nesting.xml', bytes) do |i|
+      open = (0...24).map { |d| "<l#{d}>" }.join
+      close = (0...24).reverse_each.map { |d| "</l#{d}>" }.join
+      "  #{open}v#{i}#{close}\n"
+    end
+  end
+
+  def entity_text(bytes)
+    generate('entity_text.xml', bytes) do |i|
+      %(  <description lang="en">Tom &amp; Jerry&apos;s &lt;b&gt;#{i}&lt;/b&gt; &#x201C;quoted&#x201D; &#233;t&#233;</description>\n)
+    end
+  end
+
+  def product_feed(bytes, name = 'product_feed.xml')
+    generate(name, bytes, header: %(<catalog xmlns:g="http://base.google.com/ns/1.0">\n), footer: "</catalog>\n") do |i|
+      <<-XML
+  <product id="#{i}" status="#{i.even? ? 'active' : 'inactive'}">
+    <g:title>Product #{i}</g:title>
+    <price currency="EUR">#{i % 1000}.99</price>
+    <available>true</available>
+    <country>DE</country>
+    <!-- internal note #{i} -->
+    <tags><tag>a</tag><tag>b</tag></tags>
+  </product>
+      XML
+    end
+  end
+
+  # Many small files of roughly bytes each; returns the list of paths.
+  def small_files(count, bytes)
+    dir = File.join(DIR, 'small')
+    FileUtils.mkdir_p(dir)
+    template = nil
+    (0...count).map do |n|
+      path = File.join(dir, format('file_%05d.xml', n))
+      unless File.exist?(path)
+        template ||= begin
+          src = product_feed(bytes, 'small_template.xml')
+          File.binread(src)
+        end
+        File.binwrite(path, template)
+      end
+      path
+    end
+  end
+end
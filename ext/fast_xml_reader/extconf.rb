@@ -3,4 +3,13 @@ require 'mkmf'
 
 $CFLAGS << ' -std=c99 -O3 -Wall -Wextra -Wno-unused-parameter'
 
+have_func('rb_ext_ractor_safe', 'ruby.h')
+have_func('rb_enc_interned_str', 'ruby/encoding.h')
+have_func('rb_time_timespec_new', 'ruby.h')
+have_header('sys/sdt.h')
+have_header('pthread.h')
+# Optional decompressors for .gz / .zst input
+$defs.push('-DHAVE_LIBZ') if have_library('z', 'inflate', 'zlib.h')
+$defs.push('-DHAVE_LIBZSTD') if have_library('zstd', 'ZSTD_decompressStream', 'zstd.h')
+
 create_makefile('fast_xml_reader/fast_xml_reader')
@@ -7,35 +7,97 @@
 
 #include <ruby.h>
 #include <ruby/encoding.h>
+#include <ruby/thread.h>
+#include <ruby/io.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SSE2 1
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SIMD_AVX2 1
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIMD_NEON 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+#if defined(__GNUC__)
+#define UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define UNLIKELY(x) (x)
+#define FORCE_INLINE inline
+#endif
 
 /* ------------------------------------------------------------------ */
 /* Node types matching Nokogiri::XML::Reader constants                */
 /* ------------------------------------------------------------------ */
 #define TYPE_ELEMENT      1
 #define TYPE_TEXT          3
+#define TYPE_CDATA         4
 #define TYPE_END_ELEMENT  15
 
 /* ------------------------------------------------------------------ */
-/* Name interning cache (open-addressed hash table)                   */
+/* String interning caches (open-addressed hash tables)               */
 /* ------------------------------------------------------------------ */
-#define NAME_CACHE_SIZE  512  /* must be power of 2 */
-#define NAME_CACHE_MASK  (NAME_CACHE_SIZE - 1)
+#define STR_CACHE_INITIAL   64     /* must be power of 2 */
+#define NAME_CACHE_MAX      65536  /* stop growing; further names are uncached */
+#define VALUE_CACHE_MAX     4096
+#define DEDUP_MAX_LEN       32     /* longer values are never deduplicated */
 
 typedef struct {
     const char *ptr;
     size_t len;
+    unsigned int hash;
     VALUE rb_str;  /* frozen interned Ruby String */
 } CacheEntry;
 
+/* Allocated on first use and kept at most half full */
+typedef struct {
+    CacheEntry *table;
+    size_t capacity;
+    size_t max;        /* capacity at which growth stops */
+    size_t count;
+    size_t hits;
+    size_t misses;     /* strings added to the cache */
+    size_t overflows;  /* strings allocated uncached once full */
+} StrCache;
+
 /* ------------------------------------------------------------------ */
 /* Attribute storage                                                  */
 /* ------------------------------------------------------------------ */
-#define MAX_ATTRS 32
+#define MAX_ATTRS 32  /* inline slots; wider elements spill into a heap arena */
 
 typedef struct {
     const char *name_ptr;
@@ -46,22 +108,163 @@ typedef struct {
 } AttrEntry;
 
 /* ------------------------------------------------------------------ */
-/* Reader struct                                                      */
+/* Namespace bindings (namespaces: true)                              */
+/* ------------------------------------------------------------------ */
+/* One xmlns declaration; prefix and URI bytes are copied to ns_arena at
+ * off because a streaming window may move the source bytes. */
+typedef struct {
+    size_t off;
+    size_t prefix_len;   /* 0 for the default namespace */
+    size_t uri_len;
+    int uri_has_entity;
+    int depth;           /* depth of the declaring element */
+} NsBinding;
+
+/* ------------------------------------------------------------------ */
+/* Background read-ahead for streams (prefetch: true)                 */
+/* A helper thread produces the next chunk into buf (reading an fd or */
+/* inflating compressed input) while the current window is scanned;   */
+/* stream_fill copies it over and hands buf back.                     */
+/* ------------------------------------------------------------------ */
+/* Up to len bytes into buf: 0 at the end, -1 with errno on failure */
+typedef ssize_t (*produce_fn)(void *src, char *buf, size_t len);
+
+#ifdef HAVE_PTHREAD_H
+typedef struct {
+    produce_fn produce;
+    void *src;
+    int fd;            /* polled between reads, or -1 if produce never blocks */
+    char *buf;
+    size_t capacity;
+    size_t len;        /* bytes gathered; the helper owns buf until full */
+    int full;          /* buf holds a chunk stream_fill hasn't taken */
+    int waiting;       /* stream_fill is waiting, so hand over what there is */
+    int eof;
+    int err;           /* errno of a failed read */
+    int stop;
+    int interrupted;   /* the consumer's wait was broken off by Ruby */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Prefetch;
+#else
+typedef struct Prefetch Prefetch;
+#endif
+
+typedef struct Inflater Inflater;  /* compressed input, see inflater_read */
+
+/* ------------------------------------------------------------------ */
+/* Element name sets (each_element, count_elements, find_first)       */
+/* ------------------------------------------------------------------ */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} NameRef;
+
+static inline int name_refs_match(const NameRef *refs, int count, const char *ptr, size_t len) {
+    for (int i = 0; i < count; i++) {
+        if (refs[i].len == len && memcmp(refs[i].ptr, ptr, len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* A block registered with on(event, name); name.ptr is NULL for one
+ * that takes every node of its event */
+typedef struct {
+    int event;
+    int arity;
+    NameRef name;
+    VALUE proc;
+} Handler;
+
 /* ------------------------------------------------------------------ */
+/* Instrumentation (stats: true)                                      */
+/* Every update sits behind one predictable stats_on branch.  Phase   */
+/* times are TSC cycles on x86, virtual counter ticks on AArch64 and  */
+/* nanoseconds elsewhere; phases nest, so scan includes the others.   */
+/* ------------------------------------------------------------------ */
+typedef enum { PHASE_SCAN, PHASE_ATTRS, PHASE_DECODE, PHASE_SKIP, PHASE_COUNT } StatPhase;
+
 typedef struct {
+    size_t elements;
+    size_t texts;
+    size_t cdata;
+    size_t end_elements;
+    size_t bytes_scanned;    /* bytes passed by the scanner, skipped ones included */
+    size_t bytes_skipped;    /* inside comments, PIs, DOCTYPE, CDATA and skipped subtrees */
+    size_t bytes_rescanned;  /* scanned again after a stream refill, not in bytes_scanned */
+    size_t entity_decodes;   /* values that went through the decoder */
+    size_t attr_overflows;   /* attributes stored past the MAX_ATTRS inline slots */
+    size_t collapsed_empty;  /* <x></x> folded into an empty element */
+    uint64_t cycles[PHASE_COUNT];
+} ReaderStats;
+
+static inline uint64_t stat_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#define STAT_ADD(r, field, n) do { if (UNLIKELY((r)->stats_on)) (r)->stats.field += (n); } while (0)
+#define STAT_BEGIN(r) (UNLIKELY((r)->stats_on) ? stat_clock() : 0)
+#define STAT_END(r, phase, t0) \
+    do { if (UNLIKELY((r)->stats_on)) (r)->stats.cycles[phase] += stat_clock() - (t0); } while (0)
+
+/* ------------------------------------------------------------------ */
+/* Reader struct                                                      */
+/* ------------------------------------------------------------------ */
+typedef struct FastReader {
     const char *data;
     size_t size;
     size_t pos;
     int is_mmap;       /* 1 = munmap on free, 0 = free() on free */
+    int nogvl;         /* 1 while a scan runs without the GVL */
+    size_t map_delta;  /* data - mapping start (page alignment of offset:) */
+    size_t base_offset;/* file offset of data[0] */
+
+    /* Page-cache hints for mapped input (populate:, huge_pages:,
+     * readahead:, drop_behind:); offsets are relative to data */
+    int populate;
+    int huge_pages;
+    int drop_behind;
+    size_t readahead;    /* bytes kept advised MADV_WILLNEED ahead of pos */
+    size_t advise_at;    /* pos at which to issue the next hints; SIZE_MAX when off */
+    size_t advised_to;   /* end of the range already advised ahead */
+    size_t dropped_to;   /* start of the range not yet released behind */
+
+    /* Streaming window (non-mmappable IO only) */
+    VALUE io;          /* source IO (or compressed file), Qnil when the whole document is in data */
+    size_t capacity;   /* allocated bytes behind data */
+    size_t chunk_size; /* bytes requested per IO#read */
+    size_t node_start; /* start of the current node; restart point when the window runs dry */
+    size_t window_offset; /* stream offset of data[0] */
+    size_t pin;        /* earlier restart point held by write_subtree, or SIZE_MAX */
+    int io_eof;        /* 1 once IO#read returned nil or "" */
+    int io_fd;         /* fd read directly instead of IO#read, or -1 */
+    int prefetch_on;   /* prefetch: read the next chunk on a helper thread */
+    Prefetch *prefetch;
+    Inflater *inflater;/* gzip/zstd source the window is inflated from */
+    int starved;       /* 1 if the last scan needed bytes past the window */
 
     int depth;         /* tree depth (incremented after open, decremented before close) */
     int report_depth;  /* depth to report for the current node */
     int node_type;
     int is_empty;
 
-    /* Current element name (pointer into mmap buffer) */
+    /* Current element name (pointer into mmap buffer) and its prefix */
     const char *name_ptr;
     size_t name_len;
+    const char *prefix_ptr;
+    size_t prefix_len;
 
     /* Current text value (pointer into mmap buffer or decoded) */
     const char *text_ptr;
@@ -70,20 +273,92 @@ typedef struct {
     VALUE decoded_text;   /* non-Qnil if entity-decoded text was allocated */
 
     /* Attributes for current element */
-    AttrEntry attrs[MAX_ATTRS];
+    AttrEntry *attrs;         /* attrs_inline or the overflow arena */
     int attr_count;
+    int attr_capacity;
+    AttrEntry attrs_inline[MAX_ATTRS];
+
+    /* While a name-filtered search runs, start tags whose name isn't in
+     * attr_names are stepped over without parsing their attributes */
+    int attr_filter;
+    const NameRef *attr_names;
+    int attr_name_count;
+
+    /* Interning caches for element/attribute names and, with
+     * dedup_values, for short text and attribute values */
+    StrCache name_cache;
+    StrCache value_cache;
+    int dedup_values;
+
+    /* Text handling: trim surrounding whitespace / report blank text */
+    int strip_text;
+    int keep_blanks;
+
+    /* Report CDATA sections as TYPE_CDATA nodes instead of skipping them */
+    int cdata;
+
+    /* Entity decoding output, reused across values */
+    char *scratch;
+    size_t scratch_capacity;
+
+    /* Counters for reader.stats */
+    int stats_on;
+    ReaderStats stats;
+    ReaderStats stats_kept; /* stats as of node_start, put back when a starved scan is redone */
+    size_t scanned_to;      /* stream offset bytes_scanned has counted up to */
+    uint64_t scan_t0;       /* when the current scan attempt began */
+
+    /* In-scope xmlns declarations, innermost last */
+    int namespaces;
+    NsBinding *ns;
+    int ns_count;
+    int ns_capacity;
+    char *ns_arena;
+    size_t ns_arena_len;
+    size_t ns_arena_capacity;
 
-    /* Name interning cache */
-    CacheEntry name_cache[NAME_CACHE_SIZE];
+    /* Strings are tagged with enc.  source_enc is the document's own
+     * encoding; a single-byte one is mapped to UTF-8 through transcode. */
+    rb_encoding *enc;
+    rb_encoding *source_enc;
+    rb_encoding *forced_enc; /* encoding: option, or NULL */
+    const struct Transcoder *transcode;
+    struct Transcoder *transcoder; /* last table built, kept across reset */
+    int enc_pending;         /* stream whose declaration is still unread */
+    char *transcoded;
+    size_t transcoded_capacity;
 
-    rb_encoding *utf8;
+    /* Blocks registered with on, in call order, and whether run is
+     * currently calling them */
+    Handler *handlers;
+    int handler_count;
+    int dispatching;
+
+    /* scan_node variant for the options above (see select_scanner) */
+    int (*scan)(struct FastReader *r);
 } FastReader;
 
+#define DEFAULT_CHUNK_SIZE (1024 * 1024)
+
+/* Regular files up to this size are read into a reusable heap buffer;
+ * mmap setup and teardown would cost more than the copy. */
+#define SMALL_FILE_MAX (64 * 1024)
+
+/* How far pos moves between drop_behind hints when readahead: is unset */
+#define ADVISE_STRIDE (8 * 1024 * 1024)
+
 /* ------------------------------------------------------------------ */
 /* Forward declarations                                               */
 /* ------------------------------------------------------------------ */
 static VALUE rb_cFastXmlReader;
+static ID id_read, id_write, id_fileno, id_chunk_size, id_offset, id_length, id_dedup_values,
+          id_strip_text, id_keep_blanks, id_cdata, id_attributes,
+          id_namespaces, id_stats, id_populate, id_huge_pages, id_readahead,
+          id_drop_behind, id_prefetch, id_encoding, id_start, id_text, id_end;
 static void reader_free(void *ptr);
+static void prefetch_stop(FastReader *r);
+static void inflater_free(FastReader *r);
+static void select_scanner(FastReader *r);
 static void reader_mark(void *ptr);
 static size_t reader_memsize(const void *ptr);
 
@@ -105,66 +380,242 @@ static inline unsigned int fnv1a(const char *ptr, size_t len) {
     return h;
 }
 
+/* ------------------------------------------------------------------ */
+/* Single-byte transcoding                                            */
+/* Legacy single-byte encodings agree with ASCII below 0x80, so the   */
+/* scanner runs on the source bytes unchanged and only the strings it */
+/* hands out go through a table of UTF-8 sequences for the top half.  */
+/* ------------------------------------------------------------------ */
+typedef struct Transcoder {
+    int enc_index;
+    struct { unsigned char len; char bytes[3]; } map[128];
+} Transcoder;
+
+/* The reader's table for enc, built on first use.  Only the last one is
+ * kept: a reader rarely sees more than one legacy encoding. */
+static const Transcoder *transcoder_for(FastReader *r, rb_encoding *enc) {
+    int index = rb_enc_to_index(enc);
+    Transcoder *t = r->transcoder;
+    if (t && t->enc_index == index) return t;
+
+    if (!t) t = r->transcoder = ALLOC(Transcoder);
+    t->enc_index = -1;
+    rb_encoding *utf8 = rb_utf8_encoding();
+    for (int i = 0; i < 128; i++) {
+        char c = (char)(0x80 + i);
+        /* rb_str_conv_enc hands back its argument when c has no mapping */
+        VALUE u = rb_str_conv_enc(rb_enc_str_new(&c, 1, enc), enc, utf8);
+        if (rb_enc_get(u) == utf8 && RSTRING_LEN(u) <= 3) {
+            t->map[i].len = (unsigned char)RSTRING_LEN(u);
+            memcpy(t->map[i].bytes, RSTRING_PTR(u), (size_t)RSTRING_LEN(u));
+        } else {
+            t->map[i].len = 3;
+            memcpy(t->map[i].bytes, "\xEF\xBF\xBD", 3); /* U+FFFD */
+        }
+    }
+    t->enc_index = index;
+    return t;
+}
+
+/* Point [*ptr, *ptr+*len) at a UTF-8 copy when the source needs one.
+ * The copy stays valid until the next call. */
+static void transcode_span(FastReader *r, const char **ptr, size_t *len) {
+    const Transcoder *t = r->transcode;
+    if (!t) return;
+
+    const unsigned char *s = (const unsigned char *)*ptr, *e = s + *len;
+    while (s < e && *s < 0x80) s++;
+    if (s == e) return;
+
+    if (*len * 3 > r->transcoded_capacity) {
+        size_t capacity = r->transcoded_capacity ? r->transcoded_capacity : 256;
+        while (capacity < *len * 3) capacity *= 2;
+        r->transcoded = xrealloc(r->transcoded, capacity);
+        r->transcoded_capacity = capacity;
+    }
+    size_t head = (size_t)((const char *)s - *ptr);
+    memcpy(r->transcoded, *ptr, head);
+    char *o = r->transcoded + head;
+    for (; s < e; s++) {
+        if (*s < 0x80) {
+            *o++ = (char)*s;
+            continue;
+        }
+        memcpy(o, t->map[*s - 0x80].bytes, 3);
+        o += t->map[*s - 0x80].len;
+    }
+    *ptr = r->transcoded;
+    *len = (size_t)(o - r->transcoded);
+}
+
 /* ------------------------------------------------------------------ */
 /* Name interning                                                     */
 /* ------------------------------------------------------------------ */
-static VALUE intern_name(FastReader *r, const char *ptr, size_t len) {
-    unsigned int idx = fnv1a(ptr, len) & NAME_CACHE_MASK;
+static void str_cache_insert(CacheEntry *table, size_t capacity, const CacheEntry *src) {
+    size_t mask = capacity - 1;
+    size_t i = src->hash & mask;
+    while (table[i].ptr != NULL)
+        i = (i + 1) & mask;
+    table[i] = *src;
+}
+
+static void str_cache_grow(StrCache *c) {
+    size_t capacity = c->capacity ? c->capacity * 2 : STR_CACHE_INITIAL;
+    CacheEntry *table = ZALLOC_N(CacheEntry, capacity);
+    for (size_t i = 0; i < c->capacity; i++) {
+        if (c->table[i].ptr != NULL)
+            str_cache_insert(table, capacity, &c->table[i]);
+    }
+    xfree(c->table);
+    c->table = table;
+    c->capacity = capacity;
+}
+
+/* Cached string for [ptr, len), or Qundef */
+static inline VALUE str_cache_lookup(StrCache *c, const char *ptr, size_t len, unsigned int h) {
+    /* Linear probe; the table is never more than half full */
+    if (c->capacity) {
+        size_t mask = c->capacity - 1;
+        for (size_t i = h & mask; c->table[i].ptr != NULL; i = (i + 1) & mask) {
+            CacheEntry *e = &c->table[i];
+            if (e->hash == h && e->len == len && memcmp(e->ptr, ptr, len) == 0) {
+                c->hits++;
+                return e->rb_str;
+            }
+        }
+    }
+    return Qundef;
+}
 
-    /* Linear probe */
-    for (int i = 0; i < 8; i++) {
-        CacheEntry *e = &r->name_cache[(idx + i) & NAME_CACHE_MASK];
-        if (e->ptr == NULL) {
-            /* Empty slot — create new interned string */
-            VALUE s = rb_enc_str_new(ptr, (long)len, r->utf8);
-            rb_str_freeze(s);
-            e->ptr = RSTRING_PTR(s);  /* point to Ruby string's buffer */
-            e->len = len;
-            e->rb_str = s;
-            return s;
+/* Remember frozen s under hash h, unless the cache is full */
+static void str_cache_add(StrCache *c, VALUE s, unsigned int h) {
+    if ((c->count + 1) * 2 > c->capacity) {
+        if (c->capacity >= c->max) {
+            c->overflows++;
+            return;
         }
-        if (e->len == len && memcmp(e->ptr, ptr, len) == 0) {
-            return e->rb_str;
+        str_cache_grow(c);
+    }
+
+    CacheEntry e = { RSTRING_PTR(s), (size_t)RSTRING_LEN(s), h, s };  /* ptr into Ruby string's buffer */
+    str_cache_insert(c->table, c->capacity, &e);
+    c->count++;
+    c->misses++;
+}
+
+/* Forget every entry, e.g. when strings switch encoding */
+static void str_cache_clear(StrCache *c) {
+    if (c->capacity) memset(c->table, 0, c->capacity * sizeof(CacheEntry));
+    c->count = 0;
+}
+
+static void str_cache_mark(StrCache *c) {
+    for (size_t i = 0; i < c->capacity; i++) {
+        if (c->table[i].ptr != NULL) {
+            rb_gc_mark(c->table[i].rb_str);
         }
     }
+}
+
+static VALUE intern_name(FastReader *r, const char *ptr, size_t len) {
+    transcode_span(r, &ptr, &len);
+    unsigned int h = fnv1a(ptr, len);
+    VALUE s = str_cache_lookup(&r->name_cache, ptr, len, h);
+    if (s != Qundef) return s;
+
+    s = rb_enc_str_new(ptr, (long)len, r->enc);
+    rb_str_freeze(s);
+    str_cache_add(&r->name_cache, s, h);
+    return s;
+}
+
+/* Frozen, deduplicated value String.  Entries come from Ruby's fstring
+ * table where available so equal values are shared process-wide; the
+ * per-reader cache in front of it avoids the global lookup. */
+static VALUE dedup_value(FastReader *r, const char *ptr, size_t len) {
+    unsigned int h = fnv1a(ptr, len);
+    VALUE s = str_cache_lookup(&r->value_cache, ptr, len, h);
+    if (s != Qundef) return s;
 
-    /* Cache full for this bucket — just create a frozen string */
-    VALUE s = rb_enc_str_new(ptr, (long)len, r->utf8);
+#ifdef HAVE_RB_ENC_INTERNED_STR
+    s = rb_enc_interned_str(ptr, (long)len, r->enc);
+#else
+    s = rb_enc_str_new(ptr, (long)len, r->enc);
     rb_str_freeze(s);
+#endif
+    str_cache_add(&r->value_cache, s, h);
     return s;
 }
 
+/* New String for text or attribute value bytes */
+static inline VALUE value_str(FastReader *r, const char *ptr, size_t len) {
+    if (r->dedup_values && len <= DEDUP_MAX_LEN)
+        return dedup_value(r, ptr, len);
+    return rb_enc_str_new(ptr, (long)len, r->enc);
+}
+
 /* ------------------------------------------------------------------ */
 /* GC mark                                                            */
 /* ------------------------------------------------------------------ */
 static void reader_mark(void *ptr) {
     FastReader *r = (FastReader *)ptr;
-    for (int i = 0; i < NAME_CACHE_SIZE; i++) {
-        if (r->name_cache[i].rb_str != Qnil) {
-            rb_gc_mark(r->name_cache[i].rb_str);
-        }
-    }
+    str_cache_mark(&r->name_cache);
+    str_cache_mark(&r->value_cache);
     if (r->decoded_text != Qnil) {
         rb_gc_mark(r->decoded_text);
     }
+    if (r->io != Qnil) {
+        rb_gc_mark(r->io);
+    }
+    for (int i = 0; i < r->handler_count; i++) {
+        rb_gc_mark(r->handlers[i].proc);
+    }
 }
 
 /* ------------------------------------------------------------------ */
 /* Free                                                               */
 /* ------------------------------------------------------------------ */
-static void reader_free(void *ptr) {
-    FastReader *r = (FastReader *)ptr;
+static void release_input(FastReader *r) {
     if (r->data) {
         if (r->is_mmap)
-            munmap((void *)r->data, r->size);
+            munmap((void *)(r->data - r->map_delta), r->size + r->map_delta);
         else
             xfree((void *)r->data);
+        r->data = NULL;
+        r->size = 0;
+        r->capacity = 0;
     }
+}
+
+static void reader_free(void *ptr) {
+    FastReader *r = (FastReader *)ptr;
+    prefetch_stop(r);
+    inflater_free(r);
+    release_input(r);
+    xfree(r->name_cache.table);
+    xfree(r->value_cache.table);
+    if (r->attrs != r->attrs_inline) free(r->attrs);
+    free(r->ns);
+    free(r->ns_arena);
+    xfree(r->scratch);
+    xfree(r->transcoded);
+    xfree(r->transcoder);
+    for (int i = 0; i < r->handler_count; i++) {
+        xfree((char *)r->handlers[i].name.ptr);
+    }
+    xfree(r->handlers);
     xfree(r);
 }
 
 static size_t reader_memsize(const void *ptr) {
-    return sizeof(FastReader);
+    const FastReader *r = (const FastReader *)ptr;
+    return sizeof(FastReader) + (r->is_mmap ? 0 : r->capacity) +
+           (r->name_cache.capacity + r->value_cache.capacity) * sizeof(CacheEntry) +
+           (r->attrs != r->attrs_inline ? (size_t)r->attr_capacity * sizeof(AttrEntry) : 0) +
+           (size_t)r->ns_capacity * sizeof(NsBinding) + r->ns_arena_capacity + r->scratch_capacity +
+           r->transcoded_capacity + (r->transcoder ? sizeof(Transcoder) : 0) +
+           (size_t)r->handler_count * sizeof(Handler) +
+           (r->prefetch ? sizeof(*r->prefetch) + r->chunk_size : 0);
 }
 
 /* ------------------------------------------------------------------ */
@@ -174,12 +625,154 @@ static VALUE reader_alloc(VALUE klass) {
     FastReader *r = ALLOC(FastReader);
     memset(r, 0, sizeof(FastReader));
     r->decoded_text = Qnil;
-    for (int i = 0; i < NAME_CACHE_SIZE; i++) {
-        r->name_cache[i].rb_str = Qnil;
-    }
+    r->io = Qnil;
+    r->attrs = r->attrs_inline;
+    r->attr_capacity = MAX_ATTRS;
+    r->name_cache.max = NAME_CACHE_MAX;
+    r->value_cache.max = VALUE_CACHE_MAX;
+    r->pin = SIZE_MAX;
+    select_scanner(r);
     return TypedData_Wrap_Struct(klass, &reader_type, r);
 }
 
+/* The reader behind self.  A reader another thread is scanning without
+ * the GVL is refused: its position, depth and attributes are in flux. */
+static FastReader *idle_reader(VALUE self) {
+    FastReader *r;
+    TypedData_Get_Struct(self, FastReader, &reader_type, r);
+    if (r->nogvl) rb_raise(rb_eIOError, "reader is being scanned by another thread");
+    return r;
+}
+
+/* ------------------------------------------------------------------ */
+/* Structural character classes                                       */
+/* ------------------------------------------------------------------ */
+#define CC_SPACE     0x01  /* ' ' '\t' '\n' '\r' */
+#define CC_NAME_END  0x02  /* space, '>' or '/' — terminates an element name */
+#define CC_ATTR_END  0x04  /* name end or '=' — terminates an attribute name */
+
+#define CC_WS (CC_SPACE | CC_NAME_END | CC_ATTR_END)
+
+static const unsigned char char_class[256] = {
+    [' ']  = CC_WS,
+    ['\t'] = CC_WS,
+    ['\n'] = CC_WS,
+    ['\r'] = CC_WS,
+    ['>']  = CC_NAME_END | CC_ATTR_END,
+    ['/']  = CC_NAME_END | CC_ATTR_END,
+    ['=']  = CC_ATTR_END,
+};
+
+/* ------------------------------------------------------------------ */
+/* SIMD classification kernels                                        */
+/* simd16_match() returns a mask with the bits of every byte in the   */
+/* 16-byte block whose class intersects cls (or, when invert is set,  */
+/* does not).  The first hit is at index ctz(mask) >> SIMD16_SHIFT.   */
+/* SSE2 and NEON are baseline on their architectures so they're used  */
+/* inline; AVX2 is picked at load time and only takes over once a     */
+/* span is longer than one 16-byte block, keeping short names and     */
+/* attributes on the inline path.                                     */
+/* ------------------------------------------------------------------ */
+#if defined(SIMD_SSE2)
+#define SIMD16_SHIFT 0
+
+static inline uint64_t simd16_match(const char *p, unsigned char cls, int invert) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+    if (cls & (CC_NAME_END | CC_ATTR_END))
+        m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('>')),
+                                         _mm_cmpeq_epi8(v, _mm_set1_epi8('/'))));
+    if (cls & CC_ATTR_END)
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('=')));
+    unsigned int bits = (unsigned int)_mm_movemask_epi8(m);
+    return invert ? (~bits & 0xFFFFu) : bits;
+}
+#elif defined(SIMD_NEON)
+#define SIMD16_SHIFT 2
+
+static inline uint64_t simd16_match(const char *p, unsigned char cls, int invert) {
+    uint8x16_t v = vld1q_u8((const uint8_t *)p);
+    uint8x16_t m = vorrq_u8(
+        vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\t'))),
+        vorrq_u8(vceqq_u8(v, vdupq_n_u8('\n')), vceqq_u8(v, vdupq_n_u8('\r'))));
+    if (cls & (CC_NAME_END | CC_ATTR_END))
+        m = vorrq_u8(m, vorrq_u8(vceqq_u8(v, vdupq_n_u8('>')), vceqq_u8(v, vdupq_n_u8('/'))));
+    if (cls & CC_ATTR_END)
+        m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('=')));
+    if (invert) m = vmvnq_u8(m);
+    /* Narrow each byte to a nibble: no movemask on NEON */
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(n), 0);
+}
+#endif
+
+#if defined(SIMD_AVX2)
+static int have_avx2;
+
+/* Scan 32 bytes at a time while at least 32 remain; returns the first
+ * match, or the position where the remaining tail is left to SSE2. */
+__attribute__((target("avx2")))
+static const char *avx2_scan(const char *p, const char *end, unsigned char cls, int invert) {
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    const __m256i nl = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    const __m256i gt = _mm256_set1_epi8('>'), sl = _mm256_set1_epi8('/');
+    const __m256i eq = _mm256_set1_epi8('=');
+
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+        if (cls & (CC_NAME_END | CC_ATTR_END))
+            m = _mm256_or_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, gt), _mm256_cmpeq_epi8(v, sl)));
+        if (cls & CC_ATTR_END)
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, eq));
+        unsigned int bits = (unsigned int)_mm256_movemask_epi8(m);
+        if (invert) bits = ~bits;
+        if (bits) return p + __builtin_ctz(bits);
+        p += 32;
+    }
+    return p;
+}
+#endif
+
+static inline const char *scan_class(const char *p, const char *end, unsigned char cls, int invert) {
+#if defined(SIMD_SSE2) || defined(SIMD_NEON)
+    if (end - p >= 16) {
+        uint64_t m = simd16_match(p, cls, invert);
+        if (m) return p + (__builtin_ctzll(m) >> SIMD16_SHIFT);
+        p += 16;
+#if defined(SIMD_AVX2)
+        if (have_avx2 && end - p >= 32)
+            p = avx2_scan(p, end, cls, invert);
+#endif
+        while (end - p >= 16) {
+            m = simd16_match(p, cls, invert);
+            if (m) return p + (__builtin_ctzll(m) >> SIMD16_SHIFT);
+            p += 16;
+        }
+    }
+#endif
+    if (invert) {
+        while (p < end && (char_class[(unsigned char)*p] & cls)) p++;
+    } else {
+        while (p < end && !(char_class[(unsigned char)*p] & cls)) p++;
+    }
+    return p;
+}
+
+/* First byte in [p, end) belonging to cls, or end */
+static inline const char *find_class(const char *p, const char *end, unsigned char cls) {
+    return scan_class(p, end, cls, 0);
+}
+
+/* First byte in [p, end) not belonging to cls, or end */
+static inline const char *skip_class(const char *p, const char *end, unsigned char cls) {
+    return scan_class(p, end, cls, 1);
+}
+
 /* ------------------------------------------------------------------ */
 /* Helpers: scanning                                                  */
 /* ------------------------------------------------------------------ */
@@ -188,213 +781,775 @@ static inline int at_end(FastReader *r) {
 }
 
 static inline void skip_spaces(FastReader *r) {
-    while (r->pos < r->size) {
-        unsigned char c = (unsigned char)r->data[r->pos];
-        if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
-            r->pos++;
-        else
-            break;
-    }
+    r->pos = (size_t)(skip_class(r->data + r->pos, r->data + r->size, CC_SPACE) - r->data);
 }
 
 /* Return 1 if [ptr, ptr+len) is all whitespace */
 static inline int is_blank(const char *ptr, size_t len) {
-    for (size_t i = 0; i < len; i++) {
-        unsigned char c = (unsigned char)ptr[i];
-        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
-            return 0;
-    }
-    return 1;
+    return skip_class(ptr, ptr + len, CC_SPACE) == ptr + len;
+}
+
+/* Narrow [*ptr, *ptr+*len) to exclude leading and trailing whitespace */
+static void trim_span(const char **ptr, size_t *len) {
+    const char *p = skip_class(*ptr, *ptr + *len, CC_SPACE);
+    const char *e = *ptr + *len;
+    while (e > p && (char_class[(unsigned char)e[-1]] & CC_SPACE)) e--;
+    *ptr = p;
+    *len = (size_t)(e - p);
 }
 
 /* ------------------------------------------------------------------ */
 /* Entity decoding                                                    */
 /* ------------------------------------------------------------------ */
-static VALUE decode_entities(FastReader *r, const char *src, size_t len) {
-    /* Fast path: no entities */
-    if (!memchr(src, '&', len)) {
-        return rb_enc_str_new(src, (long)len, r->utf8);
+#define ENTITY_MAX 32  /* longest "&...;" considered for decoding */
+
+/* UTF-8 for code point cp into out; 0 if cp is not a valid character */
+static inline int utf8_encode(unsigned long cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    } else if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    } else if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    } else if (cp <= 0x10FFFF) {
+        out[0] = (char)(0xF0 | (cp >> 18));
+        out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[3] = (char)(0x80 | (cp & 0x3F));
+        return 4;
+    }
+    return 0;
+}
+
+/* &#NNN; or &#xHHH; with the name (after '#') in [p, e); 0 if malformed */
+static int decode_char_ref(const char *p, const char *e, char *out) {
+    unsigned long cp = 0;
+    if (p < e && (*p == 'x' || *p == 'X')) {
+        if (++p == e) return 0;
+        for (; p < e; p++) {
+            unsigned char c = (unsigned char)*p;
+            if (c >= '0' && c <= '9') c -= '0';
+            else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') c = (unsigned char)((c | 0x20) - 'a' + 10);
+            else return 0;
+            cp = (cp << 4) | c;
+            if (cp > 0x10FFFF) return 0;
+        }
+    } else {
+        if (p == e) return 0;
+        for (; p < e; p++) {
+            if (*p < '0' || *p > '9') return 0;
+            cp = cp * 10 + (unsigned long)(*p - '0');
+            if (cp > 0x10FFFF) return 0;
+        }
+    }
+    return utf8_encode(cp, out);
+}
+
+/*
+ * Decode the entity starting at amp (which points at '&'). Writes up to
+ * four bytes to out, sets *next past the consumed input and returns the
+ * number of bytes written, which never exceeds the entity's own length.
+ * Unknown or malformed entities are passed through literally: the return
+ * value is 0 and the caller copies [amp, *next) itself.
+ */
+static int decode_entity(const char *amp, const char *end, char *out, const char **next) {
+    /* Only look a short way for ';' so a stray '&' doesn't rescan the
+     * rest of a long value; longer entities pass through literally. A
+     * second '&' ends the search so "a & b &amp;" still decodes the
+     * real entity after the stray one. */
+    const char *limit = (size_t)(end - amp) < ENTITY_MAX ? end : amp + ENTITY_MAX;
+    const char *semi = amp + 1;
+    while (semi < limit && *semi != ';' && *semi != '&') semi++;
+    if (semi == limit || *semi != ';') {
+        /* No closing ';' — copy '&' literally */
+        out[0] = '&';
+        *next = amp + 1;
+        return 1;
+    }
+    *next = semi + 1;
+
+    const char *n = amp + 1;  /* entity name */
+    switch (semi - n) {
+    case 2:
+        if (n[1] == 't') {
+            if (n[0] == 'l') { out[0] = '<'; return 1; }
+            if (n[0] == 'g') { out[0] = '>'; return 1; }
+        }
+        break;
+    case 3:
+        if (n[0] == 'a' && n[1] == 'm' && n[2] == 'p') { out[0] = '&'; return 1; }
+        break;
+    case 4:
+        if (memcmp(n, "quot", 4) == 0) { out[0] = '"'; return 1; }
+        if (memcmp(n, "apos", 4) == 0) { out[0] = '\''; return 1; }
+        break;
     }
+    if (n < semi && n[0] == '#')
+        return decode_char_ref(n + 1, semi, out);
 
-    /* Slow path: decode entities */
-    VALUE buf = rb_enc_str_new(NULL, 0, r->utf8);
-    /* Pre-allocate to source length (decoded is always <= source) */
-    rb_str_modify_expand(buf, (long)len);
+    /* Unknown entity — copy literally */
+    return 0;
+}
 
+/* Decode [src, src+len) into out, which has room for len bytes (output
+ * never grows); returns the decoded length */
+static size_t decode_into(char *out, const char *src, size_t len) {
     const char *end = src + len;
     const char *p = src;
+    char *o = out;
 
     while (p < end) {
         const char *amp = memchr(p, '&', (size_t)(end - p));
         if (!amp) {
-            rb_str_cat(buf, p, (long)(end - p));
+            memcpy(o, p, (size_t)(end - p));
+            o += end - p;
             break;
         }
+        memcpy(o, p, (size_t)(amp - p));
+        o += amp - p;
 
-        /* Copy text before '&' */
-        if (amp > p) {
-            rb_str_cat(buf, p, (long)(amp - p));
+        int n = decode_entity(amp, end, o, &p);
+        if (n) {
+            o += n;
+        } else {
+            memmove(o, amp, (size_t)(p - amp));
+            o += p - amp;
         }
+    }
+    return (size_t)(o - out);
+}
 
-        const char *semi = memchr(amp, ';', (size_t)(end - amp));
-        if (!semi) {
-            /* No closing ';' — copy '&' literally */
-            rb_str_cat(buf, amp, 1);
-            p = amp + 1;
-            continue;
-        }
+/* Per-reader scratch arena of at least len bytes, kept between calls */
+static char *scratch_buf(FastReader *r, size_t len) {
+    if (len > r->scratch_capacity) {
+        size_t capacity = r->scratch_capacity ? r->scratch_capacity : 256;
+        while (capacity < len) capacity *= 2;
+        r->scratch = xrealloc(r->scratch, capacity);
+        r->scratch_capacity = capacity;
+    }
+    return r->scratch;
+}
 
-        size_t elen = (size_t)(semi - amp - 1);  /* length of entity name */
-        const char *ename = amp + 1;
-
-        if (elen == 3 && memcmp(ename, "amp", 3) == 0) {
-            rb_str_cat(buf, "&", 1);
-        } else if (elen == 2 && memcmp(ename, "lt", 2) == 0) {
-            rb_str_cat(buf, "<", 1);
-        } else if (elen == 2 && memcmp(ename, "gt", 2) == 0) {
-            rb_str_cat(buf, ">", 1);
-        } else if (elen == 4 && memcmp(ename, "quot", 4) == 0) {
-            rb_str_cat(buf, "\"", 1);
-        } else if (elen == 4 && memcmp(ename, "apos", 4) == 0) {
-            rb_str_cat(buf, "'", 1);
-        } else if (elen > 1 && ename[0] == '#') {
-            /* Numeric entity */
-            unsigned long cp = 0;
-            if (ename[1] == 'x' || ename[1] == 'X') {
-                for (size_t i = 2; i < elen; i++) {
-                    char c = ename[i];
-                    cp <<= 4;
-                    if (c >= '0' && c <= '9') cp += (unsigned long)(c - '0');
-                    else if (c >= 'a' && c <= 'f') cp += (unsigned long)(c - 'a' + 10);
-                    else if (c >= 'A' && c <= 'F') cp += (unsigned long)(c - 'A' + 10);
-                }
-            } else {
-                for (size_t i = 1; i < elen; i++) {
-                    cp = cp * 10 + (unsigned long)(ename[i] - '0');
-                }
-            }
-            /* Encode code point as UTF-8 */
-            char u8[4];
-            int u8len;
-            if (cp < 0x80) {
-                u8[0] = (char)cp; u8len = 1;
-            } else if (cp < 0x800) {
-                u8[0] = (char)(0xC0 | (cp >> 6));
-                u8[1] = (char)(0x80 | (cp & 0x3F));
-                u8len = 2;
-            } else if (cp < 0x10000) {
-                u8[0] = (char)(0xE0 | (cp >> 12));
-                u8[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
-                u8[2] = (char)(0x80 | (cp & 0x3F));
-                u8len = 3;
-            } else {
-                u8[0] = (char)(0xF0 | (cp >> 18));
-                u8[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
-                u8[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
-                u8[3] = (char)(0x80 | (cp & 0x3F));
-                u8len = 4;
-            }
-            rb_str_cat(buf, u8, u8len);
-        } else {
-            /* Unknown entity — copy literally */
-            rb_str_cat(buf, amp, (long)(semi - amp + 1));
-        }
+/* Decode into the scratch arena; the result stays valid until the next decode */
+static size_t decode_scratch(FastReader *r, const char *src, size_t len, const char **out) {
+    uint64_t t0 = STAT_BEGIN(r);
+    STAT_ADD(r, entity_decodes, 1);
+    char *buf = scratch_buf(r, len);
+    size_t n = decode_into(buf, src, len);
+    STAT_END(r, PHASE_DECODE, t0);
+    *out = buf;
+    return n;
+}
 
-        p = semi + 1;
+static VALUE decode_entities(FastReader *r, const char *src, size_t len) {
+    /* Fast path: no entities */
+    if (!memchr(src, '&', len)) {
+        return rb_enc_str_new(src, (long)len, r->enc);
     }
 
-    return buf;
+    const char *buf;
+    size_t n = decode_scratch(r, src, len, &buf);
+    return rb_enc_str_new(buf, (long)n, r->enc);
+}
+
+/*
+ * Compare raw span [src, src+len) against [str, str+slen) as if the span
+ * had been passed through decode_entities, without building the string.
+ */
+static int span_equal(const char *src, size_t len, int has_entity, const char *str, size_t slen) {
+    if (!has_entity)
+        return len == slen && memcmp(src, str, len) == 0;
+
+    const char *end = src + len;
+    const char *s = str, *send = str + slen;
+    const char *p = src;
+
+    while (p < end) {
+        const char *amp = memchr(p, '&', (size_t)(end - p));
+        size_t plain = (size_t)((amp ? amp : end) - p);
+        if ((size_t)(send - s) < plain || memcmp(p, s, plain) != 0)
+            return 0;
+        s += plain;
+        if (!amp)
+            break;
+
+        char u8[4];
+        int u8len = decode_entity(amp, end, u8, &p);
+        const char *lit = u8len ? u8 : amp;
+        size_t llen = u8len ? (size_t)u8len : (size_t)(p - amp);
+        if ((size_t)(send - s) < llen || memcmp(lit, s, llen) != 0)
+            return 0;
+        s += llen;
+    }
+    return s == send;
 }
 
 /* ------------------------------------------------------------------ */
 /* Attribute value decode helper                                       */
 /* ------------------------------------------------------------------ */
+static VALUE decoded_value(FastReader *r, const char *src, size_t len) {
+    if (!r->dedup_values)
+        return decode_entities(r, src, len);
+    const char *buf;
+    size_t n = decode_scratch(r, src, len, &buf);
+    return value_str(r, buf, n);
+}
+
 static VALUE make_attr_value(FastReader *r, AttrEntry *a) {
+    const char *p = a->val_ptr;
+    size_t len = a->val_len;
+    transcode_span(r, &p, &len);
     if (a->val_has_entity) {
-        return decode_entities(r, a->val_ptr, a->val_len);
+        return decoded_value(r, p, len);
     }
-    return rb_enc_str_new(a->val_ptr, (long)a->val_len, r->utf8);
+    return value_str(r, p, len);
 }
 
-/* ------------------------------------------------------------------ */
-/* Skip comment: <!-- ... -->                                         */
-/* ------------------------------------------------------------------ */
-static void skip_comment(FastReader *r) {
-    /* pos is right after "<!--" */
-    while (r->pos + 2 < r->size) {
-        const char *p = memchr(r->data + r->pos, '-', r->size - r->pos - 1);
-        if (!p) { r->pos = r->size; return; }
-        r->pos = (size_t)(p - r->data);
-        if (r->pos + 2 < r->size &&
-            r->data[r->pos] == '-' &&
-            r->data[r->pos + 1] == '-' &&
-            r->data[r->pos + 2] == '>') {
-            r->pos += 3;
-            return;
-        }
-        r->pos++;
+/* String for the current text node (fresh unless dedup_values is on) */
+static VALUE make_text_value(FastReader *r) {
+    const char *p = r->text_ptr;
+    size_t len = r->text_len;
+    transcode_span(r, &p, &len);
+    if (r->text_has_entity) {
+        return decoded_value(r, p, len);
     }
-    r->pos = r->size;
+    return value_str(r, p, len);
 }
 
-/* ------------------------------------------------------------------ */
-/* Skip processing instruction: <? ... ?>                             */
-/* ------------------------------------------------------------------ */
-static void skip_pi(FastReader *r) {
-    while (r->pos + 1 < r->size) {
-        const char *p = memchr(r->data + r->pos, '?', r->size - r->pos - 1);
-        if (!p) { r->pos = r->size; return; }
-        r->pos = (size_t)(p - r->data);
-        if (r->data[r->pos + 1] == '>') {
-            r->pos += 2;
-            return;
+/* Whether the current node has a value; an empty CDATA section's is "" */
+static inline int has_value(const FastReader *r) {
+    return r->text_ptr != NULL && (r->text_len > 0 || r->node_type == TYPE_CDATA);
+}
+
+/* value of the current node: nil without text, decoded text cached per node */
+static VALUE node_value(FastReader *r) {
+    if (!has_value(r))
+        return Qnil;
+
+    if (r->text_has_entity) {
+        if (r->decoded_text == Qnil) {
+            r->decoded_text = make_text_value(r);
         }
-        r->pos++;
+        return r->decoded_text;
     }
-    r->pos = r->size;
+
+    return make_text_value(r);
 }
 
-/* ------------------------------------------------------------------ */
-/* Skip CDATA: <![CDATA[ ... ]]>                                     */
-/* ------------------------------------------------------------------ */
-static void skip_cdata(FastReader *r) {
-    while (r->pos + 2 < r->size) {
-        const char *p = memchr(r->data + r->pos, ']', r->size - r->pos - 2);
-        if (!p) { r->pos = r->size; return; }
-        r->pos = (size_t)(p - r->data);
-        if (r->data[r->pos + 1] == ']' && r->data[r->pos + 2] == '>') {
-            r->pos += 3;
-            return;
+/* Attribute of the current element named [name, name+len), or NULL */
+static AttrEntry *find_attr_span(FastReader *r, const char *name, size_t len) {
+    for (int i = 0; i < r->attr_count; i++) {
+        AttrEntry *a = &r->attrs[i];
+        if (a->name_len == len && memcmp(a->name_ptr, name, len) == 0) {
+            return a;
         }
-        r->pos++;
     }
-    r->pos = r->size;
+    return NULL;
 }
 
-/* ------------------------------------------------------------------ */
-/* Skip DOCTYPE: <!DOCTYPE ... >  (simple, no internal subset)        */
-/* ------------------------------------------------------------------ */
-static void skip_doctype(FastReader *r) {
-    int bracket_depth = 0;
-    while (r->pos < r->size) {
-        char c = r->data[r->pos++];
-        if (c == '[') bracket_depth++;
-        else if (c == ']') bracket_depth--;
-        else if (c == '>' && bracket_depth == 0) return;
+/* Attributes of the current element as a Hash keyed by interned names */
+static VALUE attrs_hash(FastReader *r) {
+    VALUE h = rb_hash_new();
+    for (int i = 0; i < r->attr_count; i++) {
+        AttrEntry *a = &r->attrs[i];
+        rb_hash_aset(h, intern_name(r, a->name_ptr, a->name_len), make_attr_value(r, a));
     }
+    return h;
 }
 
 /* ------------------------------------------------------------------ */
-/* Parse attributes of current element                                */
-/* Assumes pos is right after the element name (or after scanning     */
-/* past a namespace prefix).                                          */
-/* Returns position of '>' or '/>' terminator (after it).             */
+/* Typed values                                                       */
+/* Parsed straight from the source bytes; entity-bearing values are    */
+/* decoded first. Surrounding whitespace is ignored.                   */
 /* ------------------------------------------------------------------ */
-static void parse_attrs(FastReader *r) {
-    r->attr_count = 0;
-    r->is_empty = 0;
+#define TYPED_BUF 64
 
-    while (r->pos < r->size) {
+/* NUL-terminated copy of [p, p+len): buf when it fits, else a String kept in *tmp */
+static const char *span_cstr(const char *p, size_t len, char *buf, volatile VALUE *tmp) {
+    if (len < TYPED_BUF) {
+        memcpy(buf, p, len);
+        buf[len] = '\0';
+        return buf;
+    }
+    *tmp = rb_str_new(p, (long)len);
+    return StringValueCStr(*tmp);
+}
+
+/* Integer(str, 10) semantics with an allocation-free path for plain digits */
+static VALUE parse_integer(const char *p, size_t len) {
+    trim_span(&p, &len);
+    const char *q = p, *e = p + len;
+    int neg = 0;
+    if (q < e && (*q == '-' || *q == '+')) neg = (*q++ == '-');
+    if (q < e && e - q <= 18) {
+        int64_t v = 0;
+        while (q < e && *q >= '0' && *q <= '9') v = v * 10 + (*q++ - '0');
+        if (q == e) return LL2NUM(neg ? -v : v);
+    }
+
+    char buf[TYPED_BUF];
+    volatile VALUE tmp = Qnil;
+    VALUE n = rb_cstr_to_inum(span_cstr(p, len, buf, &tmp), 10, 1);
+    RB_GC_GUARD(tmp);
+    return n;
+}
+
+/* Float(str) semantics */
+static VALUE parse_float(const char *p, size_t len) {
+    trim_span(&p, &len);
+    char buf[TYPED_BUF];
+    volatile VALUE tmp = Qnil;
+    double d = rb_cstr_to_dbl(span_cstr(p, len, buf, &tmp), 1);
+    RB_GC_GUARD(tmp);
+    return DBL2NUM(d);
+}
+
+/* xs:boolean: true/false/1/0 */
+static VALUE parse_boolean(const char *p, size_t len) {
+    trim_span(&p, &len);
+    if ((len == 4 && memcmp(p, "true", 4) == 0) || (len == 1 && *p == '1')) return Qtrue;
+    if ((len == 5 && memcmp(p, "false", 5) == 0) || (len == 1 && *p == '0')) return Qfalse;
+    rb_raise(rb_eArgError, "invalid boolean: %.*s", (int)(len > 32 ? 32 : len), p);
+    return Qnil;
+}
+
+static int read_digits(const char **p, const char *e, int n, int *out) {
+    int v = 0;
+    for (int i = 0; i < n; i++, (*p)++) {
+        if (*p >= e || **p < '0' || **p > '9') return 0;
+        v = v * 10 + (**p - '0');
+    }
+    *out = v;
+    return 1;
+}
+
+/* Days since 1970-01-01 for a proleptic Gregorian date */
+static int64_t days_from_civil(int64_t y, int m, int d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/*
+ * ISO 8601 / xs:dateTime: YYYY-MM-DD[THH:MM[:SS[.frac]]][Z|(+|-)HH:MM].
+ * A zone-less value is local time, like Time.iso8601.
+ */
+static VALUE parse_time(const char *p, size_t len) {
+    trim_span(&p, &len);
+    const char *q = p, *e = p + len;
+    int year, mon, day, hour = 0, min = 0, sec = 0;
+    long nsec = 0;
+    int has_zone = 0, is_utc = 0, offset = 0;
+
+    if (!read_digits(&q, e, 4, &year) || q >= e || *q++ != '-' ||
+        !read_digits(&q, e, 2, &mon) || q >= e || *q++ != '-' ||
+        !read_digits(&q, e, 2, &day))
+        goto bad;
+    if (q < e && (*q == 'T' || *q == 't' || *q == ' ')) {
+        q++;
+        if (!read_digits(&q, e, 2, &hour) || q >= e || *q++ != ':' ||
+            !read_digits(&q, e, 2, &min))
+            goto bad;
+        if (q < e && *q == ':') {
+            q++;
+            if (!read_digits(&q, e, 2, &sec)) goto bad;
+            if (q < e && (*q == '.' || *q == ',')) {
+                long scale = 100000000;
+                if (++q >= e || *q < '0' || *q > '9') goto bad;
+                for (; q < e && *q >= '0' && *q <= '9'; q++, scale /= 10)
+                    nsec += (*q - '0') * scale;
+            }
+        }
+    }
+    if (q < e && (*q == 'Z' || *q == 'z')) {
+        q++;
+        has_zone = is_utc = 1;
+    } else if (q < e && (*q == '+' || *q == '-')) {
+        int neg = (*q++ == '-'), oh, om = 0;
+        if (!read_digits(&q, e, 2, &oh)) goto bad;
+        if (q < e && *q == ':') q++;
+        if (q < e && !read_digits(&q, e, 2, &om)) goto bad;
+        if (oh > 23 || om > 59) goto bad;
+        offset = (oh * 3600 + om * 60) * (neg ? -1 : 1);
+        has_zone = 1;
+    }
+    if (q != e || mon < 1 || mon > 12 || day < 1 || day > 31 ||
+        hour > 23 || min > 59 || sec > 60)
+        goto bad;
+
+    if (!has_zone) {
+        return rb_funcall(rb_cTime, rb_intern("local"), 7,
+                          INT2FIX(year), INT2FIX(mon), INT2FIX(day),
+                          INT2FIX(hour), INT2FIX(min), INT2FIX(sec),
+                          rb_rational_new(LONG2NUM(nsec), INT2FIX(1000)));
+    }
+
+    time_t t = (time_t)(days_from_civil(year, mon, day) * 86400 +
+                        hour * 3600 + min * 60 + sec - offset);
+#ifdef HAVE_RB_TIME_TIMESPEC_NEW
+    struct timespec ts;
+    ts.tv_sec = t;
+    ts.tv_nsec = nsec;
+    /* INT_MAX - 1 asks for a UTC Time */
+    return rb_time_timespec_new(&ts, is_utc ? INT_MAX - 1 : offset);
+#else
+    VALUE tm = rb_time_nano_new(t, nsec);
+    if (is_utc)
+        return rb_funcall(tm, rb_intern("utc"), 0);
+    return rb_funcall(tm, rb_intern("localtime"), 1, INT2FIX(offset));
+#endif
+
+bad:
+    rb_raise(rb_eArgError, "invalid xmlschema time: %.*s", (int)(len > 64 ? 64 : len), p);
+    return Qnil;
+}
+
+typedef VALUE (*typed_parser)(const char *, size_t);
+
+/* Parse an attribute or text span, decoding entities first if needed */
+static VALUE parse_span(FastReader *r, const char *p, size_t len, int has_entity, typed_parser fn) {
+    if (!has_entity)
+        return fn(p, len);
+    const char *buf;
+    size_t n = decode_scratch(r, p, len, &buf);
+    return fn(buf, n);
+}
+
+/* ------------------------------------------------------------------ */
+/* Span scanners                                                      */
+/* Each looks for a hit starting in [p, limit), reading at most up to */
+/* end, and returns it or NULL.  Resuming at limit continues the same */
+/* search, which lets scan_span() split a long span into windows.     */
+/* ------------------------------------------------------------------ */
+typedef const char *(*span_fn)(const char *p, const char *limit, const char *end, void *arg);
+
+typedef struct {
+    const char *str;
+    size_t len;
+} Seq;
+
+static const char *memchr_span(const char *p, const char *limit, const char *end, void *arg) {
+    return memchr(p, *(const char *)arg, (size_t)(limit - p));
+}
+
+static const char *seq_span(const char *p, const char *limit, const char *end, void *arg) {
+    const Seq *seq = (const Seq *)arg;
+    while (p < limit) {
+        const char *q = memchr(p, seq->str[0], (size_t)(limit - p));
+        if (!q) return NULL;
+        if ((size_t)(end - q) >= seq->len && memcmp(q, seq->str, seq->len) == 0)
+            return q;
+        p = q + 1;
+    }
+    return NULL;
+}
+
+/* '>' closing a DOCTYPE; arg tracks '[' ... ']' internal subset depth */
+static const char *doctype_span(const char *p, const char *limit, const char *end, void *arg) {
+    int *bracket_depth = (int *)arg;
+    for (; p < limit; p++) {
+        char c = *p;
+        if (c == '[') (*bracket_depth)++;
+        else if (c == ']') (*bracket_depth)--;
+        else if (c == '>' && *bracket_depth == 0) return p;
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* GVL release for long scans                                         */
+/* The first NOGVL_THRESHOLD bytes are scanned with the GVL held so   */
+/* short spans never pay for the switch.  The rest runs without it in */
+/* NOGVL_WINDOW steps, checking for a thread interrupt between them.  */
+/* ------------------------------------------------------------------ */
+#define NOGVL_THRESHOLD (256 * 1024)
+#define NOGVL_WINDOW    (4 * 1024 * 1024)
+
+typedef struct {
+    span_fn fn;
+    const char *p;
+    const char *end;
+    void *arg;
+    const char *result;
+    volatile int cancel;
+} SpanCall;
+
+static void *span_call_nogvl(void *ptr) {
+    SpanCall *c = (SpanCall *)ptr;
+    while (c->p < c->end && !c->cancel) {
+        const char *limit = (size_t)(c->end - c->p) > NOGVL_WINDOW ? c->p + NOGVL_WINDOW : c->end;
+        c->result = c->fn(c->p, limit, c->end, c->arg);
+        if (c->result) break;
+        c->p = limit;
+    }
+    return NULL;
+}
+
+static void span_call_ubf(void *ptr) {
+    ((SpanCall *)ptr)->cancel = 1;
+}
+
+static VALUE check_ints_body(VALUE ptr) {
+    rb_thread_check_ints();
+    return Qnil;
+}
+
+/* Handle interrupts between GVL-free steps.  The reader stays marked
+ * while other threads get to run, and is unmarked if Ruby raises. */
+static void nogvl_check_ints(FastReader *r) {
+    int state = 0;
+    rb_protect(check_ints_body, Qnil, &state);
+    if (state) {
+        r->nogvl = 0;
+        rb_jump_tag(state);
+    }
+}
+
+static inline const char *scan_span(FastReader *r, span_fn fn, const char *p, const char *end, void *arg) {
+    if ((size_t)(end - p) <= NOGVL_THRESHOLD || r->nogvl)
+        return fn(p, end, end, arg);
+
+    const char *hit = fn(p, p + NOGVL_THRESHOLD, end, arg);
+    if (hit) return hit;
+
+    SpanCall c = { fn, p + NOGVL_THRESHOLD, end, arg, NULL, 0 };
+    r->nogvl = 1;
+    for (;;) {
+        rb_thread_call_without_gvl(span_call_nogvl, &c, span_call_ubf, &c);
+        if (c.result || c.p >= c.end) break;
+        /* Interrupted: let Ruby raise if needed, otherwise resume */
+        nogvl_check_ints(r);
+        c.cancel = 0;
+    }
+    r->nogvl = 0;
+    return c.result;
+}
+
+/* Run step(r, arg) until it returns 0, without the GVL.  For loops   */
+/* over an in-memory document that touch no Ruby objects.             */
+typedef struct {
+    FastReader *r;
+    int (*step)(FastReader *r, void *arg);
+    void *arg;
+    int done;
+    volatile int cancel;
+} LoopCall;
+
+static void *loop_call_nogvl(void *ptr) {
+    LoopCall *c = (LoopCall *)ptr;
+    while (!c->cancel) {
+        if (!c->step(c->r, c->arg)) { c->done = 1; break; }
+    }
+    return NULL;
+}
+
+static void loop_call_ubf(void *ptr) {
+    ((LoopCall *)ptr)->cancel = 1;
+}
+
+static void run_without_gvl(FastReader *r, int (*step)(FastReader *r, void *arg), void *arg) {
+    LoopCall c = { r, step, arg, 0, 0 };
+    r->nogvl = 1;
+    for (;;) {
+        rb_thread_call_without_gvl(loop_call_nogvl, &c, loop_call_ubf, &c);
+        if (c.done) break;
+        nogvl_check_ints(r);
+        c.cancel = 0;
+    }
+    r->nogvl = 0;
+}
+
+static const Seq SEQ_COMMENT_END = { "-->", 3 };
+static const Seq SEQ_PI_END      = { "?>", 2 };
+static const Seq SEQ_CDATA_END   = { "]]>", 3 };
+
+/* Move pos past the first seq at or after pos, or to the end */
+static void skip_past(FastReader *r, const Seq *seq) {
+    uint64_t t0 = STAT_BEGIN(r);
+    size_t start = r->pos;
+    const char *hit = scan_span(r, seq_span, r->data + r->pos, r->data + r->size, (void *)seq);
+    r->pos = hit ? (size_t)(hit - r->data) + seq->len : r->size;
+    STAT_ADD(r, bytes_skipped, r->pos - start);
+    STAT_END(r, PHASE_SKIP, t0);
+}
+
+/* ------------------------------------------------------------------ */
+/* Skip comment: <!-- ... -->                                         */
+/* ------------------------------------------------------------------ */
+static void skip_comment(FastReader *r) {
+    /* pos is right after "<!--" */
+    skip_past(r, &SEQ_COMMENT_END);
+}
+
+/* ------------------------------------------------------------------ */
+/* Skip processing instruction: <? ... ?>                             */
+/* ------------------------------------------------------------------ */
+static void skip_pi(FastReader *r) {
+    skip_past(r, &SEQ_PI_END);
+}
+
+/* ------------------------------------------------------------------ */
+/* Skip CDATA: <![CDATA[ ... ]]>                                     */
+/* ------------------------------------------------------------------ */
+static void skip_cdata(FastReader *r) {
+    skip_past(r, &SEQ_CDATA_END);
+}
+
+/* CDATA node: text served straight from the buffer, never decoded.
+ * Returns 0 if the section is unterminated. */
+static int scan_cdata(FastReader *r) {
+    const char *start = r->data + r->pos;
+    const char *hit = scan_span(r, seq_span, start, r->data + r->size, (void *)&SEQ_CDATA_END);
+    if (!hit) {
+        r->pos = r->size;
+        return 0;
+    }
+    r->pos = (size_t)(hit - r->data) + SEQ_CDATA_END.len;
+
+    r->node_type = TYPE_CDATA;
+    r->report_depth = r->depth;
+    r->text_ptr = start;
+    r->text_len = (size_t)(hit - start);
+    r->text_has_entity = 0;
+    r->is_empty = 0;
+    r->name_ptr = NULL;
+    r->name_len = 0;
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Skip DOCTYPE: <!DOCTYPE ... >  (simple, no internal subset)        */
+/* ------------------------------------------------------------------ */
+static void skip_doctype(FastReader *r) {
+    uint64_t t0 = STAT_BEGIN(r);
+    size_t start = r->pos;
+    int bracket_depth = 0;
+    const char *gt = scan_span(r, doctype_span, r->data + r->pos, r->data + r->size, &bracket_depth);
+    r->pos = gt ? (size_t)(gt - r->data) + 1 : r->size;
+    STAT_ADD(r, bytes_skipped, r->pos - start);
+    STAT_END(r, PHASE_SKIP, t0);
+}
+
+/* ------------------------------------------------------------------ */
+/* Attribute overflow arena                                           */
+/* Kept for the reader's lifetime once an element has more than      */
+/* MAX_ATTRS attributes.  Plain malloc because parse_attrs may run    */
+/* without the GVL; on failure the extra attributes are dropped.      */
+/* ------------------------------------------------------------------ */
+static int grow_attrs(FastReader *r) {
+    int capacity = r->attr_capacity * 2;
+    AttrEntry *attrs;
+    if (r->attrs == r->attrs_inline) {
+        attrs = malloc(sizeof(AttrEntry) * (size_t)capacity);
+        if (attrs) memcpy(attrs, r->attrs_inline, sizeof(r->attrs_inline));
+    } else {
+        attrs = realloc(r->attrs, sizeof(AttrEntry) * (size_t)capacity);
+    }
+    if (!attrs) return 0;
+    r->attrs = attrs;
+    r->attr_capacity = capacity;
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Namespace binding stack                                            */
+/* Declarations are pushed while parsing a start tag and popped once  */
+/* the scanner is back at or above the declaring depth.  Plain malloc */
+/* for the same reason as the attribute arena.                        */
+/* ------------------------------------------------------------------ */
+static inline void ns_pop_to(FastReader *r, int depth) {
+    while (r->ns_count > 0 && r->ns[r->ns_count - 1].depth >= depth) {
+        r->ns_count--;
+        r->ns_arena_len = r->ns[r->ns_count].off;
+    }
+}
+
+static void ns_push(FastReader *r, const char *prefix, size_t plen,
+                    const char *uri, size_t ulen, int has_entity) {
+    if (r->ns_count == r->ns_capacity) {
+        int capacity = r->ns_capacity ? r->ns_capacity * 2 : 8;
+        NsBinding *ns = realloc(r->ns, sizeof(NsBinding) * (size_t)capacity);
+        if (!ns) return;
+        r->ns = ns;
+        r->ns_capacity = capacity;
+    }
+    if (r->ns_arena_len + plen + ulen > r->ns_arena_capacity) {
+        size_t capacity = r->ns_arena_capacity ? r->ns_arena_capacity * 2 : 256;
+        while (capacity < r->ns_arena_len + plen + ulen) capacity *= 2;
+        char *arena = realloc(r->ns_arena, capacity);
+        if (!arena) return;
+        r->ns_arena = arena;
+        r->ns_arena_capacity = capacity;
+    }
+
+    NsBinding *b = &r->ns[r->ns_count++];
+    b->off = r->ns_arena_len;
+    b->prefix_len = plen;
+    b->uri_len = ulen;
+    b->uri_has_entity = has_entity;
+    b->depth = r->depth;
+    memcpy(r->ns_arena + b->off, prefix, plen);
+    memcpy(r->ns_arena + b->off + plen, uri, ulen);
+    r->ns_arena_len += plen + ulen;
+}
+
+/* Innermost binding for prefix, or NULL; an empty URI undeclares it */
+static const NsBinding *ns_lookup(FastReader *r, const char *prefix, size_t plen) {
+    for (int i = r->ns_count - 1; i >= 0; i--) {
+        const NsBinding *b = &r->ns[i];
+        if (b->prefix_len == plen && memcmp(r->ns_arena + b->off, prefix, plen) == 0)
+            return b->uri_len ? b : NULL;
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Scanner variants.  scan_node_body and parse_attrs take the options */
+/* that change how a node is scanned as a compile-time flags word.    */
+/* One copy is built per combination, and select_scanner picks the    */
+/* reader's once, so a disabled option costs no branch in the scan.   */
+/* ------------------------------------------------------------------ */
+#define SCAN_NS          0x01  /* namespaces: */
+#define SCAN_CDATA       0x02  /* cdata: */
+#define SCAN_KEEP_BLANKS 0x04  /* keep_blanks: */
+#define SCAN_STRIP       0x08  /* strip_text: */
+#define SCAN_STATS       0x10  /* stats: */
+#define SCAN_VARIANTS    0x20
+
+#define SCAN_STAT_ADD(flags, r, field, n) \
+    do { if ((flags) & SCAN_STATS) (r)->stats.field += (n); } while (0)
+#define SCAN_STAT_BEGIN(flags) (((flags) & SCAN_STATS) ? stat_clock() : 0)
+#define SCAN_STAT_END(flags, r, phase, t0) \
+    do { if ((flags) & SCAN_STATS) (r)->stats.cycles[phase] += stat_clock() - (t0); } while (0)
+/* Remember the counters at node_start, with the scan time spent so far */
+#define SCAN_STAT_KEEP(flags, r) \
+    do { \
+        if ((flags) & SCAN_STATS) { \
+            (r)->stats_kept = (r)->stats; \
+            (r)->stats_kept.cycles[PHASE_SCAN] += stat_clock() - (r)->scan_t0; \
+        } \
+    } while (0)
+
+/* ------------------------------------------------------------------ */
+/* Parse attributes of current element                                */
+/* Assumes pos is right after the element name (or after scanning     */
+/* past a namespace prefix).                                          */
+/* Returns position of '>' or '/>' terminator (after it).             */
+/* ------------------------------------------------------------------ */
+static FORCE_INLINE void parse_attrs(FastReader *r, const unsigned flags) {
+    r->attr_count = 0;
+    r->is_empty = 0;
+
+    while (r->pos < r->size) {
         skip_spaces(r);
         if (at_end(r)) return;
 
@@ -414,12 +1569,7 @@ static void parse_attrs(FastReader *r) {
 
         /* Attribute name */
         size_t name_start = r->pos;
-        while (r->pos < r->size) {
-            c = r->data[r->pos];
-            if (c == '=' || c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '>' || c == '/')
-                break;
-            r->pos++;
-        }
+        r->pos = (size_t)(find_class(r->data + r->pos, r->data + r->size, CC_ATTR_END) - r->data);
         size_t name_end = r->pos;
 
         /* Skip to '=' */
@@ -450,37 +1600,152 @@ static void parse_attrs(FastReader *r) {
 
         r->pos = val_end + 1; /* skip closing quote */
 
-        /* Skip namespace attributes (xmlns and xmlns:*) */
+        /* Skip namespace attributes (xmlns and xmlns:*), recording them
+         * as bindings in namespace-aware mode */
         size_t nlen = name_end - name_start;
         if (nlen >= 5 && memcmp(r->data + name_start, "xmlns", 5) == 0 &&
             (nlen == 5 || r->data[name_start + 5] == ':')) {
+            if (flags & SCAN_NS) {
+                size_t plen = nlen > 5 ? nlen - 6 : 0;
+                ns_push(r, r->data + name_start + 6, plen, r->data + val_start,
+                        val_end - val_start, has_entity);
+            }
             continue;
         }
 
-        if (r->attr_count < MAX_ATTRS) {
+        if (r->attr_count < r->attr_capacity || grow_attrs(r)) {
             AttrEntry *a = &r->attrs[r->attr_count++];
             a->name_ptr = r->data + name_start;
             a->name_len = nlen;
             a->val_ptr = r->data + val_start;
             a->val_len = val_end - val_start;
             a->val_has_entity = has_entity;
+            if (r->attr_count > MAX_ATTRS) SCAN_STAT_ADD(flags, r, attr_overflows, 1);
+        }
+    }
+}
+
+/* '>' ending a start tag, skipping over quoted attribute values */
+static const char *tag_end(const char *p, const char *end) {
+    for (;;) {
+        const char *gt = memchr(p, '>', (size_t)(end - p));
+        if (!gt) return NULL;
+        const char *dq = memchr(p, '"', (size_t)(gt - p));
+        const char *sq = memchr(p, '\'', (size_t)(gt - p));
+        const char *q = (dq && (!sq || dq < sq)) ? dq : sq;
+        if (!q) return gt;
+        const char *close = memchr(q + 1, *q, (size_t)(end - q - 1));
+        if (!close) return NULL;
+        p = close + 1;
+    }
+}
+
+/* Step over the attributes of a start tag without recording them; the
+ * counterpart of parse_attrs for tags a filtered search doesn't want */
+static void skip_attrs(FastReader *r) {
+    r->attr_count = 0;
+    const char *gt = tag_end(r->data + r->pos, r->data + r->size);
+    if (!gt) {
+        r->is_empty = 0;
+        r->pos = r->size;
+        return;
+    }
+    r->is_empty = gt > r->data + r->pos && gt[-1] == '/';
+    r->pos = (size_t)(gt - r->data) + 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Make the current node the end element "</nptr ...>" closed by gt   */
+/* ------------------------------------------------------------------ */
+static inline void set_end_element(FastReader *r, const char *nptr, const char *gt, int namespaces) {
+    /* Extract name (strip namespace prefix) */
+    size_t raw_len = (size_t)(gt - nptr);
+    const char *colon = memchr(nptr, ':', raw_len);
+    r->prefix_ptr = nptr;
+    r->prefix_len = 0;
+    if (colon) {
+        size_t prefix_len = (size_t)(colon - nptr) + 1;
+        r->prefix_len = prefix_len - 1;
+        nptr += prefix_len;
+        raw_len -= prefix_len;
+    }
+    /* Trim trailing whitespace */
+    while (raw_len > 0 && ((unsigned char)nptr[raw_len-1] <= ' '))
+        raw_len--;
+
+    r->name_ptr = nptr;
+    r->name_len = raw_len;
+    r->node_type = TYPE_END_ELEMENT;
+    r->is_empty = 0;
+    if (r->depth > 0) r->depth--;
+    r->report_depth = r->depth;
+    if (namespaces) ns_pop_to(r, r->depth + 1);
+}
+
+/* ------------------------------------------------------------------ */
+/* Page-cache hints for mapped input.  Every advise_stride bytes the  */
+/* next readahead window is advised MADV_WILLNEED and, with           */
+/* drop_behind, pages before the current node are released.  Nothing  */
+/* keeps pointers behind node_start, and a released page of a private */
+/* read-only file mapping just faults back in if seek_to returns.     */
+/* ------------------------------------------------------------------ */
+static inline size_t advise_stride(const FastReader *r) {
+    return r->readahead ? (r->readahead + 1) / 2 : ADVISE_STRIDE;
+}
+
+static void advise_input(FastReader *r) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char *base = (char *)r->data - r->map_delta;  /* page aligned */
+    size_t map_len = r->size + r->map_delta;
+
+#ifdef MADV_WILLNEED
+    if (r->readahead) {
+        size_t from = r->map_delta + r->pos;
+        size_t to = from + r->readahead < map_len ? from + r->readahead : map_len;
+        if (r->advised_to > from) from = r->advised_to;
+        from -= from % page;
+        if (to > from) madvise(base + from, to - from, MADV_WILLNEED);
+        r->advised_to = to;
+    }
+#endif
+    if (r->drop_behind) {
+        size_t keep = r->map_delta + r->node_start;
+        keep -= keep % page;
+        if (keep > r->dropped_to) {
+#ifdef MADV_COLD
+            madvise(base + r->dropped_to, keep - r->dropped_to, MADV_COLD);
+#endif
+            madvise(base + r->dropped_to, keep - r->dropped_to, MADV_DONTNEED);
+            r->dropped_to = keep;
         }
     }
+    r->advise_at = r->pos + advise_stride(r);
+}
+
+static inline void advise_check(FastReader *r) {
+    if (UNLIKELY(r->pos >= r->advise_at)) advise_input(r);
 }
 
 /* ------------------------------------------------------------------ */
-/* read — advance to next node                                        */
-/* Returns 1 if a node was read, 0 if EOF.                            */
+/* scan_node — parse the next node out of [data, data+size)           */
+/* Returns 1 if a node was read, 0 if the buffer is exhausted.        */
 /* ------------------------------------------------------------------ */
-static int reader_read_internal(FastReader *r) {
+static FORCE_INLINE int scan_node_body(FastReader *r, const unsigned flags) {
     r->decoded_text = Qnil;
+    r->prefix_len = 0;
     r->text_ptr = NULL;
     r->text_len = 0;
     r->text_has_entity = 0;
     r->attr_count = 0;
+    r->node_start = r->pos;
+    SCAN_STAT_KEEP(flags, r);
 
 again:
     if (at_end(r)) return 0;
+    /* Everything before here was skipped without changing reader state,
+     * so a streaming refill only needs to keep bytes from this point on. */
+    r->node_start = r->pos;
+    SCAN_STAT_KEEP(flags, r);
 
     if (r->data[r->pos] == '<') {
         r->pos++; /* skip '<' */
@@ -498,25 +1763,7 @@ again:
             if (!gt) { r->pos = r->size; return 0; }
             r->pos = (size_t)(gt - r->data) + 1;
 
-            /* Extract name (strip namespace prefix) */
-            size_t raw_len = (size_t)(gt - r->data) - name_start;
-            const char *nptr = r->data + name_start;
-            const char *colon = memchr(nptr, ':', raw_len);
-            if (colon) {
-                size_t prefix_len = (size_t)(colon - nptr) + 1;
-                nptr += prefix_len;
-                raw_len -= prefix_len;
-            }
-            /* Trim trailing whitespace */
-            while (raw_len > 0 && ((unsigned char)nptr[raw_len-1] <= ' '))
-                raw_len--;
-
-            r->name_ptr = nptr;
-            r->name_len = raw_len;
-            r->node_type = TYPE_END_ELEMENT;
-            r->is_empty = 0;
-            if (r->depth > 0) r->depth--;
-            r->report_depth = r->depth;
+            set_end_element(r, r->data + name_start, gt, flags & SCAN_NS);
             return 1;
         }
 
@@ -532,8 +1779,11 @@ again:
         if (c == '!' && r->pos + 7 < r->size &&
             memcmp(r->data + r->pos, "![CDATA[", 8) == 0) {
             r->pos += 8;
-            skip_cdata(r);
-            goto again;
+            if (!(flags & SCAN_CDATA)) {
+                skip_cdata(r);
+                goto again;
+            }
+            return scan_cdata(r);
         }
 
         /* DOCTYPE: <!DOCTYPE */
@@ -555,13 +1805,7 @@ again:
         size_t name_start = r->pos;
 
         /* Scan element name */
-        while (r->pos < r->size) {
-            c = r->data[r->pos];
-            if (c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
-                c == '>' || c == '/')
-                break;
-            r->pos++;
-        }
+        r->pos = (size_t)(find_class(r->data + r->pos, r->data + r->size, CC_NAME_END) - r->data);
 
         size_t name_end = r->pos;
         const char *nptr = r->data + name_start;
@@ -569,8 +1813,11 @@ again:
 
         /* Strip namespace prefix */
         const char *colon = memchr(nptr, ':', nlen);
+        r->prefix_ptr = nptr;
+        r->prefix_len = 0;
         if (colon) {
             size_t prefix_len = (size_t)(colon - nptr) + 1;
+            r->prefix_len = prefix_len - 1;
             nptr += prefix_len;
             nlen -= prefix_len;
         }
@@ -578,9 +1825,18 @@ again:
         r->name_ptr = nptr;
         r->name_len = nlen;
         r->node_type = TYPE_ELEMENT;
+        if (flags & SCAN_NS) ns_pop_to(r, r->depth);
 
-        /* Parse attributes and detect self-closing */
-        parse_attrs(r);
+        /* Parse attributes and detect self-closing.  Namespace mode
+         * needs every tag's xmlns declarations, so it never filters. */
+        if (!(flags & SCAN_NS) && r->attr_filter &&
+            !name_refs_match(r->attr_names, r->attr_name_count, nptr, nlen)) {
+            skip_attrs(r);
+        } else {
+            uint64_t t0 = SCAN_STAT_BEGIN(flags);
+            parse_attrs(r, flags);
+            SCAN_STAT_END(flags, r, PHASE_ATTRS, t0);
+        }
 
         /* For self-closing elements, don't increment depth — the element
          * is emitted at the current depth and no end-element follows.
@@ -588,6 +1844,7 @@ again:
         if (!r->is_empty) {
             /* Check if next content is immediately </name> — collapse to empty */
             size_t saved = r->pos;
+            if (r->pos + 1 >= r->size) r->starved = 1;
             if (r->pos + 1 < r->size && r->data[r->pos] == '<' && r->data[r->pos + 1] == '/') {
                 /* Peek ahead: is it "</samename>"? */
                 size_t peek = r->pos + 2;
@@ -611,11 +1868,13 @@ again:
                     if (close_name_len == nlen && memcmp(close_nptr, nptr, nlen) == 0) {
                         /* Collapse: treat as empty element */
                         r->is_empty = 1;
+                        SCAN_STAT_ADD(flags, r, collapsed_empty, 1);
                         r->pos = (size_t)(gt - r->data) + 1;
                     } else {
                         r->pos = saved;
                     }
                 } else {
+                    r->starved = 1;
                     r->pos = saved;
                 }
             }
@@ -631,7 +1890,8 @@ again:
     } else {
         /* Text content: scan to next '<' */
         size_t text_start = r->pos;
-        const char *lt = memchr(r->data + r->pos, '<', r->size - r->pos);
+        char lt_char = '<';
+        const char *lt = scan_span(r, memchr_span, r->data + r->pos, r->data + r->size, &lt_char);
         size_t text_end;
         if (lt) {
             text_end = (size_t)(lt - r->data);
@@ -642,15 +1902,18 @@ again:
         }
 
         size_t tlen = text_end - text_start;
+        const char *tptr = r->data + text_start;
 
-        /* Skip blank text nodes (NOBLANKS equivalent) */
-        if (is_blank(r->data + text_start, tlen)) {
-            goto again;
+        /* Skip blank text nodes (NOBLANKS equivalent) unless asked to keep them */
+        if (is_blank(tptr, tlen)) {
+            if (!(flags & SCAN_KEEP_BLANKS)) goto again;
+        } else if (flags & SCAN_STRIP) {
+            trim_span(&tptr, &tlen);
         }
 
         r->node_type = TYPE_TEXT;
         r->report_depth = r->depth;
-        r->text_ptr = r->data + text_start;
+        r->text_ptr = tptr;
         r->text_len = tlen;
         r->text_has_entity = (memchr(r->text_ptr, '&', tlen) != NULL) ? 1 : 0;
         r->is_empty = 0;
@@ -661,139 +1924,2086 @@ again:
     }
 }
 
-/* ------------------------------------------------------------------ */
-/* Ruby methods                                                       */
-/* ------------------------------------------------------------------ */
-/* Read all data from a Ruby IO into a malloc'd buffer (read in 1MB chunks). */
-static void reader_init_from_io(FastReader *r, VALUE io) {
-    ID id_read = rb_intern("read");
-    VALUE chunk_size = INT2FIX(1024 * 1024);
-
-    size_t capacity = 4 * 1024 * 1024;  /* 4MB initial */
-    size_t total = 0;
-    char *buf = xmalloc(capacity);
-
-    for (;;) {
-        VALUE chunk = rb_funcall(io, id_read, 1, chunk_size);
-        if (NIL_P(chunk) || RSTRING_LEN(chunk) == 0) break;
+/* Whether a scan stands: a stream node that ran into the end of the
+ * window is scanned again from node_start after a refill */
+static inline int scan_settled(const FastReader *r, int ret) {
+    return r->io == Qnil || r->io_eof || (ret && !r->starved && r->pos < r->size);
+}
 
-        size_t clen = (size_t)RSTRING_LEN(chunk);
-        while (total + clen > capacity) {
-            capacity *= 2;
-            buf = xrealloc(buf, capacity);
-        }
-        memcpy(buf + total, RSTRING_PTR(chunk), clen);
-        total += clen;
-    }
+static FORCE_INLINE int scan_node_variant(FastReader *r, const unsigned flags) {
+    if (!(flags & SCAN_STATS)) return scan_node_body(r, flags);
 
-    if (total == 0) {
-        xfree(buf);
-        r->data = NULL;
-        r->size = 0;
-    } else {
-        /* Shrink to exact size */
-        buf = xrealloc(buf, total);
-        r->data = buf;
-        r->size = total;
+    r->scan_t0 = stat_clock();
+    int ret = scan_node_body(r, flags);
+    if (!scan_settled(r, ret)) {
+        /* Only what lies before node_start is not scanned again */
+        r->stats = r->stats_kept;
+        r->stats.bytes_rescanned += r->pos - r->node_start;
+        return ret;
     }
-    r->is_mmap = 0;
+    size_t at = r->window_offset + r->pos;
+    r->stats.bytes_scanned += at - r->scanned_to;
+    r->scanned_to = at;
+    r->stats.cycles[PHASE_SCAN] += stat_clock() - r->scan_t0;
+    return ret;
 }
 
-static VALUE reader_initialize(VALUE self, VALUE arg) {
-    FastReader *r;
-    TypedData_Get_Struct(self, FastReader, &reader_type, r);
-
-    r->utf8 = rb_utf8_encoding();
-    r->pos = 0;
-    r->depth = 0;
-    r->node_type = 0;
-    r->is_empty = 0;
-
-    if (RB_TYPE_P(arg, T_STRING)) {
-        /* File path — mmap */
-        const char *fpath = StringValueCStr(arg);
-
-        int fd = open(fpath, O_RDONLY);
-        if (fd < 0) rb_sys_fail(fpath);
+#define SCAN_VARIANT_LIST(X) \
+    X(0)  X(1)  X(2)  X(3)  X(4)  X(5)  X(6)  X(7)  \
+    X(8)  X(9)  X(10) X(11) X(12) X(13) X(14) X(15) \
+    X(16) X(17) X(18) X(19) X(20) X(21) X(22) X(23) \
+    X(24) X(25) X(26) X(27) X(28) X(29) X(30) X(31)
 
-        struct stat st;
-        if (fstat(fd, &st) < 0) { close(fd); rb_sys_fail(fpath); }
+#define SCAN_VARIANT_DEF(n) \
+    static int scan_node_v##n(FastReader *r) { return scan_node_variant(r, n); }
+#define SCAN_VARIANT_REF(n) scan_node_v##n,
 
-        if (st.st_size == 0) {
-            close(fd);
-            r->data = NULL;
-            r->size = 0;
-            r->is_mmap = 1;
-            return self;
-        }
+SCAN_VARIANT_LIST(SCAN_VARIANT_DEF)
 
-        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-        close(fd);
-        if (map == MAP_FAILED) rb_sys_fail("mmap");
-        madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+static int (*const scan_variants[SCAN_VARIANTS])(FastReader *r) = {
+    SCAN_VARIANT_LIST(SCAN_VARIANT_REF)
+};
 
-        r->data = (const char *)map;
-        r->size = (size_t)st.st_size;
-        r->is_mmap = 1;
-    } else {
-        /* IO with fd — try mmap first */
-        int use_mmap = 0;
+/* Point r->scan at the variant built for the reader's options */
+static void select_scanner(FastReader *r) {
+    unsigned flags = (r->namespaces ? SCAN_NS : 0) |
+                     (r->cdata ? SCAN_CDATA : 0) |
+                     (r->keep_blanks ? SCAN_KEEP_BLANKS : 0) |
+                     (r->strip_text ? SCAN_STRIP : 0) |
+                     (r->stats_on ? SCAN_STATS : 0);
+    r->scan = scan_variants[flags];
+}
 
-        if (rb_respond_to(arg, rb_intern("fileno"))) {
-            VALUE vfd = rb_funcall(arg, rb_intern("fileno"), 0);
-            if (FIXNUM_P(vfd)) {
-                int fd = FIX2INT(vfd);
-                struct stat st;
-                if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
-                    off_t cur = lseek(fd, 0, SEEK_CUR);
-                    if (cur == 0) {
-                        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-                        if (map != MAP_FAILED) {
-                            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
-                            r->data = (const char *)map;
-                            r->size = (size_t)st.st_size;
-                            r->is_mmap = 1;
-                            use_mmap = 1;
-                        }
-                    }
-                }
-            }
-        }
+static inline int scan_node(FastReader *r) {
+    advise_check(r);
+    /* A direct call for the default options keeps that path as before */
+    if (r->scan == scan_node_v0) return scan_node_v0(r);
+    return r->scan(r);
+}
 
-        if (!use_mmap) {
-            reader_init_from_io(r, arg);
+/* Count and trace a node that is about to be reported */
+static inline void node_emitted(FastReader *r) {
+#ifdef HAVE_SYS_SDT_H
+    DTRACE_PROBE5(fast_xml_reader, node, r->node_type, r->report_depth,
+                  r->name_ptr, r->name_len, r->window_offset + r->node_start);
+#endif
+    if (UNLIKELY(r->stats_on)) {
+        switch (r->node_type) {
+        case TYPE_ELEMENT:     r->stats.elements++; break;
+        case TYPE_TEXT:        r->stats.texts++; break;
+        case TYPE_CDATA:       r->stats.cdata++; break;
+        case TYPE_END_ELEMENT: r->stats.end_elements++; break;
         }
     }
+}
 
-    return self;
+/* ------------------------------------------------------------------ */
+/* Native fd reads for streams backed by a Ruby File, pipe or socket  */
+/* with nothing buffered on the Ruby side: read(2) goes straight into */
+/* the window without the GVL, or runs ahead on a helper thread.      */
+/* ------------------------------------------------------------------ */
+
+static inline int fd_wait(int fd, int timeout_ms) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, timeout_ms);
 }
 
-static VALUE reader_read(VALUE self) {
-    FastReader *r;
-    TypedData_Get_Struct(self, FastReader, &reader_type, r);
+/* read(2) that waits out EAGAIN on a non-blocking fd */
+static ssize_t fd_read(int fd, char *buf, size_t len) {
+    for (;;) {
+        ssize_t n = read(fd, buf, len);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return n;
+        if (fd_wait(fd, -1) < 0) return -1;
+    }
+}
 
-    if (reader_read_internal(r)) {
-        return Qtrue;
+/* At least one byte (or EOF), then whatever else is ready right away: a
+ * pipe hands out at most its buffer per read */
+static ssize_t fd_read_ready(int fd, char *buf, size_t len) {
+    ssize_t got = fd_read(fd, buf, len);
+    while (got > 0 && (size_t)got < len && fd_wait(fd, 0) > 0) {
+        ssize_t n = read(fd, buf + got, len - (size_t)got);
+        if (n <= 0) break;  /* EOF or error shows up on the next call */
+        got += n;
     }
-    return Qfalse;
+    return got;
+}
+
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    ssize_t n;
+    int err;
+} FdRead;
+
+static void *fd_read_nogvl(void *ptr) {
+    FdRead *a = (FdRead *)ptr;
+    a->n = fd_read_ready(a->fd, a->buf, a->len);
+    a->err = errno;
+    return NULL;
+}
+
+/* fd of io if it can be read natively, or -1 */
+static int native_fd(VALUE io, int fd) {
+    if (fd < 0 || !RB_TYPE_P(io, T_FILE)) return -1;
+    rb_io_t *fptr;
+    GetOpenFile(io, fptr);
+    return rb_io_read_pending(fptr) ? -1 : fd;
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Gather into buf until it is full or stream_fill is waiting for data,
+ * then hand it over and wait for it to be taken.  While something is
+ * gathered, polls with a short timeout so a waiting consumer is served
+ * without a byte more having to arrive.
+ */
+static void *prefetch_main(void *ptr) {
+    Prefetch *pf = (Prefetch *)ptr;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_mutex_lock(&pf->lock);
+    while (!pf->stop && !pf->eof && !pf->err) {
+        if (pf->full) {
+            pthread_cond_wait(&pf->cond, &pf->lock);
+            continue;
+        }
+        if (pf->len > 0 && (pf->waiting || pf->len == pf->capacity)) {
+            pf->full = 1;
+            pthread_cond_broadcast(&pf->cond);
+            continue;
+        }
+        size_t len = pf->len;
+        pthread_mutex_unlock(&pf->lock);
+
+        /* Only blocking waits can be cancelled, never with the lock held */
+        ssize_t n = -1;
+        int err = EINTR;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        if (len == 0 || pf->fd < 0 || fd_wait(pf->fd, 1) > 0) {
+            n = pf->produce(pf->src, pf->buf + len, pf->capacity - len);
+            err = errno;
+        }
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        pthread_mutex_lock(&pf->lock);
+        if (n > 0) {
+            pf->len += (size_t)n;
+        } else if (n == 0 || err != EINTR) {
+            if (n == 0) pf->eof = 1;
+            else pf->err = err;
+            pf->full = pf->len > 0;  /* the tail still goes out first */
+            pthread_cond_broadcast(&pf->cond);
+        }
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return NULL;
+}
+
+static ssize_t fd_produce(void *src, char *buf, size_t len) {
+    return fd_read(*(int *)src, buf, len);
+}
+
+/* Start a helper thread on produce; on failure fills stay synchronous */
+static void prefetch_start(FastReader *r, produce_fn produce, void *src, int fd) {
+    Prefetch *pf = ZALLOC(Prefetch);
+    pf->produce = produce;
+    pf->fd = fd;
+    pf->src = produce == fd_produce ? (void *)&pf->fd : src;
+    pf->capacity = r->chunk_size;
+    pf->buf = xmalloc(pf->capacity);
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->cond, NULL);
+
+    /* Signals stay with Ruby's threads */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&pf->thread, NULL, prefetch_main, pf);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (err) {
+        pthread_mutex_destroy(&pf->lock);
+        pthread_cond_destroy(&pf->cond);
+        xfree(pf->buf);
+        xfree(pf);
+        return;
+    }
+    r->prefetch = pf;
+}
+
+static void prefetch_stop(FastReader *r) {
+    Prefetch *pf = r->prefetch;
+    if (!pf) return;
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = 1;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+    pthread_cancel(pf->thread);  /* breaks a read blocked on an idle pipe */
+    pthread_join(pf->thread, NULL);
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->cond);
+    xfree(pf->buf);
+    xfree(pf);
+    r->prefetch = NULL;
+}
+
+static void *prefetch_wait_nogvl(void *ptr) {
+    Prefetch *pf = (Prefetch *)ptr;
+    pthread_mutex_lock(&pf->lock);
+    while (!pf->full && !pf->eof && !pf->err && !pf->interrupted)
+        pthread_cond_wait(&pf->cond, &pf->lock);
+    pthread_mutex_unlock(&pf->lock);
+    return NULL;
+}
+
+static void prefetch_wait_ubf(void *ptr) {
+    Prefetch *pf = (Prefetch *)ptr;
+    pthread_mutex_lock(&pf->lock);
+    pf->interrupted = 1;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+}
+#else
+static ssize_t fd_produce(void *src, char *buf, size_t len) {
+    return fd_read(*(int *)src, buf, len);
+}
+static void prefetch_start(FastReader *r, produce_fn produce, void *src, int fd) {}
+static void prefetch_stop(FastReader *r) {}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* Compressed input.  A file that starts with a gzip or zstd magic    */
+/* number is not scanned in place: its mapped (or read-in) bytes      */
+/* become the source of a streaming window that is inflated into.     */
+/* ------------------------------------------------------------------ */
+enum { COMPRESS_NONE, COMPRESS_GZIP, COMPRESS_ZSTD };
+
+struct Inflater {
+    int format;
+    const char *src;      /* compressed bytes */
+    size_t src_len;
+    size_t src_pos;
+    void *map;            /* mapping behind src, or NULL if src is heap */
+    size_t map_len;
+    int done;
+    const char *error;    /* why inflater_read failed (static string) */
+#ifdef HAVE_LIBZ
+    z_stream zs;
+    int zs_open;
+#endif
+#ifdef HAVE_LIBZSTD
+    ZSTD_DStream *zd;
+#endif
+};
+
+static int compress_format(const char *p, size_t len) {
+    if (len >= 2 && (unsigned char)p[0] == 0x1f && (unsigned char)p[1] == 0x8b)
+        return COMPRESS_GZIP;
+    if (len >= 4 && memcmp(p, "\x28\xb5\x2f\xfd", 4) == 0)
+        return COMPRESS_ZSTD;
+    return COMPRESS_NONE;
+}
+
+#ifdef HAVE_LIBZ
+static ssize_t gzip_read(Inflater *inf, char *buf, size_t len) {
+    z_stream *zs = &inf->zs;
+    zs->next_out = (Bytef *)buf;
+    zs->avail_out = len > UINT_MAX ? UINT_MAX : (uInt)len;
+    uInt room = zs->avail_out;
+
+    while (zs->avail_out > 0) {
+        size_t avail = inf->src_len - inf->src_pos;
+        zs->next_in = (Bytef *)(inf->src + inf->src_pos);
+        zs->avail_in = avail > UINT_MAX ? UINT_MAX : (uInt)avail;
+        int ret = inflate(zs, Z_NO_FLUSH);
+        inf->src_pos = (size_t)((const char *)zs->next_in - inf->src);
+
+        if (ret == Z_STREAM_END) {
+            /* gzip and pigz may write several members back to back */
+            if (compress_format(inf->src + inf->src_pos, inf->src_len - inf->src_pos) == COMPRESS_GZIP) {
+                inflateReset(zs);
+                continue;
+            }
+            inf->done = 1;
+            break;
+        }
+        if (ret != Z_OK) {
+            if (zs->avail_out < room) break;  /* hand out what we have first */
+            inf->error = (ret == Z_BUF_ERROR && avail == 0) ? "truncated gzip input"
+                       : zs->msg ? zs->msg : "corrupt gzip input";
+            errno = EIO;
+            return -1;
+        }
+    }
+    return (ssize_t)(room - zs->avail_out);
+}
+#endif
+
+#ifdef HAVE_LIBZSTD
+static ssize_t zstd_read(Inflater *inf, char *buf, size_t len) {
+    ZSTD_outBuffer out = { buf, len, 0 };
+
+    while (out.pos < out.size) {
+        ZSTD_inBuffer in = { inf->src, inf->src_len, inf->src_pos };
+        size_t ret = ZSTD_decompressStream(inf->zd, &out, &in);
+        inf->src_pos = in.pos;
+
+        if (ZSTD_isError(ret)) {
+            if (out.pos) break;
+            inf->error = ZSTD_getErrorName(ret);
+            errno = EIO;
+            return -1;
+        }
+        if (in.pos == in.size && out.pos < out.size) {
+            /* Everything is flushed: either the last frame ended or
+             * the input stops in the middle of one */
+            if (ret == 0) {
+                inf->done = 1;
+                break;
+            }
+            if (out.pos) break;
+            inf->error = "truncated zstd input";
+            errno = EIO;
+            return -1;
+        }
+    }
+    return (ssize_t)out.pos;
+}
+#endif
+
+/* produce_fn over an Inflater; touches no Ruby objects */
+static ssize_t inflater_read(void *ptr, char *buf, size_t len) {
+    Inflater *inf = (Inflater *)ptr;
+    if (inf->done) return 0;
+    switch (inf->format) {
+#ifdef HAVE_LIBZ
+    case COMPRESS_GZIP: return gzip_read(inf, buf, len);
+#endif
+#ifdef HAVE_LIBZSTD
+    case COMPRESS_ZSTD: return zstd_read(inf, buf, len);
+#endif
+    }
+    return 0;
+}
+
+static void inflater_free(FastReader *r) {
+    Inflater *inf = r->inflater;
+    if (!inf) return;
+#ifdef HAVE_LIBZ
+    if (inf->zs_open) inflateEnd(&inf->zs);
+#endif
+#ifdef HAVE_LIBZSTD
+    if (inf->zd) ZSTD_freeDStream(inf->zd);
+#endif
+    if (inf->map)
+        munmap(inf->map, inf->map_len);
+    else
+        xfree((void *)inf->src);
+    xfree(inf);
+    r->inflater = NULL;
+}
+
+/* Hand the loaded bytes to an Inflater of format; data becomes an
+ * empty heap window */
+static void inflater_open(FastReader *r, int format) {
+#ifndef HAVE_LIBZ
+    if (format == COMPRESS_GZIP)
+        rb_raise(rb_eNotImpError, "gzip input requires fast_xml_reader built with zlib");
+#endif
+#ifndef HAVE_LIBZSTD
+    if (format == COMPRESS_ZSTD)
+        rb_raise(rb_eNotImpError, "zstd input requires fast_xml_reader built with libzstd");
+#endif
+    Inflater *inf = ZALLOC(Inflater);
+    inf->format = format;
+    inf->src = r->data;
+    inf->src_len = r->size;
+    if (r->is_mmap) {
+        inf->map = (void *)(r->data - r->map_delta);
+        inf->map_len = r->size + r->map_delta;
+    }
+    r->inflater = inf;
+    r->data = NULL;
+    r->size = 0;
+    r->capacity = 0;
+    r->is_mmap = 0;
+    r->map_delta = 0;
+    r->advise_at = SIZE_MAX;
+
+#ifdef HAVE_LIBZ
+    if (format == COMPRESS_GZIP) {
+        if (inflateInit2(&inf->zs, 15 + 16) != Z_OK)  /* gzip wrapper only */
+            rb_raise(rb_eNoMemError, "failed to set up gzip decoder");
+        inf->zs_open = 1;
+    }
+#endif
+#ifdef HAVE_LIBZSTD
+    if (format == COMPRESS_ZSTD) {
+        inf->zd = ZSTD_createDStream();
+        if (!inf->zd || ZSTD_isError(ZSTD_initDStream(inf->zd)))
+            rb_raise(rb_eNoMemError, "failed to set up zstd decoder");
+    }
+#endif
+}
+
+/* ------------------------------------------------------------------ */
+/* Streaming window refill                                            */
+/* Drops everything before node_start, then appends the next chunk of */
+/* the IO.  Reads grow with the retained node so a single huge text   */
+/* or comment is rescanned a logarithmic number of times.             */
+/* ------------------------------------------------------------------ */
+
+/* Room for extra more bytes after the window */
+static char *window_reserve(FastReader *r, size_t extra) {
+    if (r->size + extra > r->capacity) {
+        size_t capacity = r->capacity ? r->capacity * 2 : r->chunk_size;
+        while (capacity < r->size + extra) capacity *= 2;
+        r->data = xrealloc((void *)r->data, capacity);
+        r->capacity = capacity;
+    }
+    return (char *)r->data + r->size;
+}
+
+static void fd_fill(FastReader *r, size_t want) {
+    FdRead a = { r->io_fd, window_reserve(r, want), want, 0, 0 };
+    for (;;) {
+        rb_thread_call_without_gvl(fd_read_nogvl, &a, RUBY_UBF_IO, NULL);
+        if (a.n >= 0) break;
+        if (a.err != EINTR) {
+            errno = a.err;
+            rb_sys_fail("read");
+        }
+        rb_thread_check_ints();
+    }
+    if (a.n == 0) r->io_eof = 1;
+    r->size += (size_t)a.n;
+}
+
+typedef struct {
+    Inflater *inf;
+    char *buf;
+    size_t len;
+    ssize_t n;
+} InflateCall;
+
+static void *inflate_nogvl(void *ptr) {
+    InflateCall *c = (InflateCall *)ptr;
+    c->n = inflater_read(c->inf, c->buf, c->len);
+    return NULL;
+}
+
+static void inflate_fill(FastReader *r, size_t want) {
+    InflateCall c = { r->inflater, window_reserve(r, want), want, 0 };
+    rb_thread_call_without_gvl(inflate_nogvl, &c, NULL, NULL);
+    if (c.n < 0) rb_raise(rb_eIOError, "%s", r->inflater->error);
+    if (c.n == 0) r->io_eof = 1;
+    r->size += (size_t)c.n;
+}
+
+#ifdef HAVE_PTHREAD_H
+/* Append handoffs from the helper until at least min bytes, and at least
+ * one handoff, have arrived; EOF or an error ends the wait early */
+static void prefetch_fill(FastReader *r, size_t min) {
+    Prefetch *pf = r->prefetch;
+    size_t got = 0;
+    for (;;) {
+        pthread_mutex_lock(&pf->lock);
+        pf->interrupted = 0;
+        pf->waiting = 1;
+        pthread_mutex_unlock(&pf->lock);
+        rb_thread_call_without_gvl(prefetch_wait_nogvl, pf, prefetch_wait_ubf, pf);
+
+        pthread_mutex_lock(&pf->lock);
+        int full = pf->full, eof = pf->eof, err = pf->err;
+        size_t len = pf->len;
+        pf->waiting = 0;
+        pthread_mutex_unlock(&pf->lock);
+
+        if (full) {
+            /* The helper leaves buf alone until full is cleared */
+            memcpy(window_reserve(r, len), pf->buf, len);
+            r->size += len;
+            got += len;
+            pthread_mutex_lock(&pf->lock);
+            pf->len = 0;
+            pf->full = 0;
+            pthread_cond_broadcast(&pf->cond);
+            pthread_mutex_unlock(&pf->lock);
+            if (got >= min) return;
+            continue;
+        }
+        if (eof) {
+            /* Whatever was gathered is scanned before EOF is reported */
+            if (got == 0) r->io_eof = 1;
+            return;
+        }
+        if (err) {
+            if (got > 0) return;
+            if (r->inflater) rb_raise(rb_eIOError, "%s", r->inflater->error);
+            errno = err;
+            rb_sys_fail("read");
+        }
+        rb_thread_check_ints();
+    }
+}
+#endif
+
+/* ------------------------------------------------------------------ */
+/* Encoding detection                                                 */
+/* ------------------------------------------------------------------ */
+/* How much of a stream to pull in looking for the end of the XML declaration */
+#define DECL_PEEK_MAX 1024
+
+/* Encoding named by an <?xml ... encoding="..."?> declaration at pos, or NULL */
+static rb_encoding *declared_encoding(const FastReader *r) {
+    const char *p = r->data + r->pos, *e = r->data + r->size;
+    if (e - p < 6 || memcmp(p, "<?xml", 5) != 0 || !(char_class[(unsigned char)p[5]] & CC_SPACE))
+        return NULL;
+    const char *gt = memchr(p, '>', (size_t)(e - p));
+    if (!gt) return NULL;
+
+    for (const char *s = p + 6; gt - s > 8; s++) {
+        if (memcmp(s, "encoding", 8) != 0) continue;
+        s = skip_class(s + 8, gt, CC_SPACE);
+        if (s == gt || *s != '=') return NULL;
+        s = skip_class(s + 1, gt, CC_SPACE);
+        if (s == gt || (*s != '"' && *s != '\'')) return NULL;
+        const char *close = memchr(s + 1, *s, (size_t)(gt - s - 1));
+        char name[64];
+        size_t n = close ? (size_t)(close - s - 1) : sizeof(name);
+        if (n == 0 || n >= sizeof(name)) return NULL;
+        memcpy(name, s + 1, n);
+        name[n] = '\0';
+        int index = rb_enc_find_index(name);
+        return index < 0 ? NULL : rb_enc_from_index(index);
+    }
+    return NULL;
+}
+
+/* Build strings for a document in enc */
+static void set_encoding(FastReader *r, rb_encoding *enc) {
+    rb_encoding *utf8 = rb_utf8_encoding();
+    if (!rb_enc_asciicompat(enc)) enc = utf8;
+
+    rb_encoding *tag = enc;
+    const Transcoder *transcode = NULL;
+    if (enc == rb_usascii_encoding() || enc == rb_ascii8bit_encoding()) {
+        tag = utf8;
+    } else if (enc != utf8 && rb_enc_mbmaxlen(enc) == 1) {
+        tag = utf8;
+        transcode = transcoder_for(r, enc);
+    }
+
+    /* Cached strings carry the previous document's encoding */
+    if (r->enc && r->enc != tag) {
+        str_cache_clear(&r->name_cache);
+        str_cache_clear(&r->value_cache);
+    }
+    r->enc = tag;
+    r->source_enc = enc;
+    r->transcode = transcode;
+}
+
+/* The encoding: option, else a UTF-8 BOM or the XML declaration at the
+ * start of the document, else UTF-8.  A UTF-8 BOM is skipped. */
+static void detect_encoding(FastReader *r) {
+    rb_encoding *enc = r->forced_enc;
+    const unsigned char *p = (const unsigned char *)r->data;
+    r->enc_pending = 0;
+
+    if (r->base_offset + r->window_offset == 0 && r->pos == 0 && r->size >= 2) {
+        if (r->size >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF) {
+            r->pos = r->node_start = 3;
+            if (!enc) enc = rb_utf8_encoding();
+        } else if ((p[0] == 0xFE && p[1] == 0xFF) || (p[0] == 0xFF && p[1] == 0xFE)) {
+            rb_raise(rb_eArgError, "UTF-16 and UTF-32 input is not supported");
+        }
+        if (!enc) enc = declared_encoding(r);
+    }
+    set_encoding(r, enc ? enc : rb_utf8_encoding());
+}
+
+/* Slide the window past consumed bytes and append the next chunk */
+static void window_fill(FastReader *r) {
+    char *buf = (char *)r->data;
+    size_t from = r->node_start < r->pin ? r->node_start : r->pin;
+    size_t keep = r->size - from;
+
+    if (from > 0) {
+        memmove(buf, buf + from, keep);
+        r->window_offset += from;
+        r->pos -= from;
+        r->size = keep;
+        r->node_start -= from;
+        if (r->pin != SIZE_MAX) r->pin -= from;
+    }
+
+    size_t want = keep > r->chunk_size ? keep : r->chunk_size;
+#ifdef HAVE_PTHREAD_H
+    if (r->prefetch) {
+        /* Handoffs are at most chunk_size: gather enough of them to
+         * double a retained node that has outgrown the chunk */
+        prefetch_fill(r, keep > r->chunk_size ? want : 0);
+        return;
+    }
+#endif
+    if (r->inflater) {
+        inflate_fill(r, want);
+        return;
+    }
+    if (r->io_fd >= 0) {
+        fd_fill(r, want);
+        return;
+    }
+
+    VALUE chunk = rb_funcall(r->io, id_read, 1, SIZET2NUM(want));
+    if (NIL_P(chunk) || RSTRING_LEN(chunk) == 0) {
+        r->io_eof = 1;
+        return;
+    }
+    StringValue(chunk);
+
+    size_t clen = (size_t)RSTRING_LEN(chunk);
+    memcpy(window_reserve(r, clen), RSTRING_PTR(chunk), clen);
+    r->size += clen;
+}
+
+static void stream_fill(FastReader *r) {
+    window_fill(r);
+    /* Wait for the end of a leading XML declaration before reading it */
+    if (UNLIKELY(r->enc_pending) &&
+        (r->io_eof || r->window_offset > 0 || r->size >= DECL_PEEK_MAX ||
+         (r->size > 0 && memchr(r->data, '>', r->size))))
+        detect_encoding(r);
+}
+
+/* ------------------------------------------------------------------ */
+/* read — advance to next node                                        */
+/* Returns 1 if a node was read, 0 if EOF.                            */
+/* In streaming mode a node that touches the end of the window may be */
+/* incomplete, so it is rescanned after pulling in more data.         */
+/* ------------------------------------------------------------------ */
+static int read_node(FastReader *r) {
+    if (r->nogvl) rb_raise(rb_eIOError, "reader is being scanned by another thread");
+    if (r->io == Qnil) return scan_node(r);
+
+    for (;;) {
+        /* Nothing is scanned before the BOM and declaration have been
+         * looked at, however small the chunks */
+        if (UNLIKELY(r->enc_pending)) {
+            stream_fill(r);
+            continue;
+        }
+        int depth = r->depth;
+        r->starved = 0;
+        int ret = scan_node(r);
+        if (scan_settled(r, ret))
+            return ret;
+
+        r->depth = depth;
+        r->pos = r->node_start;
+        stream_fill(r);
+    }
+}
+
+static int reader_read_internal(FastReader *r) {
+    int ret = read_node(r);
+    if (ret) node_emitted(r);
+    return ret;
+}
+
+/* ------------------------------------------------------------------ */
+/* Subtree skipping                                                   */
+/* Only looks at '<' and the construct it opens: no attribute entries */
+/* and no nodes are produced until the matching end tag.              */
+/* ------------------------------------------------------------------ */
+
+/* Consume one construct at or after pos, adjusting *depth.  Returns 0
+ * if it ran out of data; node_start then marks where to resume. */
+static int skip_step(FastReader *r, int *depth) {
+    advise_check(r);
+    const char *end = r->data + r->size;
+    char lt_char = '<';
+    const char *lt = scan_span(r, memchr_span, r->data + r->pos, end, &lt_char);
+    if (!lt) {
+        r->pos = r->node_start = r->size;  /* text only: nothing to keep */
+        return 0;
+    }
+    r->node_start = (size_t)(lt - r->data);
+
+    const char *p = lt + 1;
+    if (end - p < 9) {
+        /* Too short to tell the construct apart; wait for more if we can */
+        if (r->io != Qnil && !r->io_eof) return 0;
+        if (p >= end) { r->pos = r->size; return 0; }
+    }
+
+    const char *stop;
+    if (*p == '/') {
+        stop = memchr(p, '>', (size_t)(end - p));
+        if (!stop) return 0;
+        if (--(*depth) == 0) set_end_element(r, p + 1, stop, r->namespaces);
+    } else if (*p == '!' && end - p >= 3 && p[1] == '-' && p[2] == '-') {
+        stop = scan_span(r, seq_span, p + 3, end, (void *)&SEQ_COMMENT_END);
+        if (!stop) return 0;
+        stop += SEQ_COMMENT_END.len - 1;
+    } else if (*p == '!' && end - p >= 8 && memcmp(p, "![CDATA[", 8) == 0) {
+        stop = scan_span(r, seq_span, p + 8, end, (void *)&SEQ_CDATA_END);
+        if (!stop) return 0;
+        stop += SEQ_CDATA_END.len - 1;
+    } else if (*p == '?') {
+        stop = scan_span(r, seq_span, p + 1, end, (void *)&SEQ_PI_END);
+        if (!stop) return 0;
+        stop += SEQ_PI_END.len - 1;
+    } else {
+        stop = tag_end(p, end);
+        if (!stop) return 0;
+        if (stop[-1] != '/') (*depth)++;
+    }
+
+    r->pos = (size_t)(stop - r->data) + 1;
+    return 1;
+}
+
+static int skip_step_nogvl(FastReader *r, void *arg) {
+    int *depth = (int *)arg;
+    return skip_step(r, depth) && *depth > 0;
+}
+
+/* Skip to the end tag matching the current open element, which becomes
+ * the current node.  Returns 0 if the document ends first. */
+static int skip_subtree_internal(FastReader *r) {
+    if (r->node_type != TYPE_ELEMENT || r->is_empty) return 1;
+
+    r->decoded_text = Qnil;
+    r->text_ptr = NULL;
+    r->text_len = 0;
+    r->attr_count = 0;
+
+    uint64_t t0 = STAT_BEGIN(r);
+    size_t start = r->window_offset + r->pos;
+    int depth = 1;
+    size_t limit = r->pos + NOGVL_THRESHOLD;
+    while (depth > 0) {
+        if (r->io == Qnil && r->pos > limit) {
+            run_without_gvl(r, skip_step_nogvl, &depth);
+            if (depth > 0) break;
+            continue;
+        }
+        if (skip_step(r, &depth)) continue;
+        if (r->io == Qnil || r->io_eof) break;
+        if (r->nogvl) rb_raise(rb_eIOError, "reader is being scanned by another thread");
+        STAT_ADD(r, bytes_rescanned, r->pos - r->node_start);
+        r->pos = r->node_start;
+        stream_fill(r);
+    }
+
+    if (UNLIKELY(r->stats_on)) {
+        size_t at = r->window_offset + r->pos;
+        r->stats.bytes_skipped += at - start;
+        r->stats.bytes_scanned += at - r->scanned_to;
+        r->scanned_to = at;
+        STAT_END(r, PHASE_SKIP, t0);
+    }
+
+    if (depth > 0) {
+        /* Truncated document */
+        r->node_type = 0;
+        r->name_ptr = NULL;
+        r->name_len = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Ruby methods                                                       */
+/* ------------------------------------------------------------------ */
+/* Set up a streaming window over a Ruby IO; data arrives on demand.  */
+/* Heap buffers (data with capacity) are kept across reset and reused */
+static void reader_init_from_io(FastReader *r, VALUE io, int fd) {
+    r->size = 0;
+    r->is_mmap = 0;
+    r->io = io;
+    r->io_eof = 0;
+    r->window_offset = 0;
+    r->io_fd = native_fd(io, fd);
+    if (r->io_fd >= 0 && r->prefetch_on) prefetch_start(r, fd_produce, NULL, r->io_fd);
+}
+
+/* Read all of a small regular file into the heap buffer */
+static int read_whole(FastReader *r, int fd, size_t file_size) {
+    if (file_size > r->capacity) {
+        r->data = xrealloc((void *)r->data, file_size);
+        r->capacity = file_size;
+    }
+    r->is_mmap = 0;
+    r->size = 0;
+
+    while (r->size < file_size) {
+        ssize_t n = pread(fd, (char *)r->data + r->size, file_size - r->size, (off_t)r->size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        if (n == 0) break;  /* truncated since fstat */
+        r->size += (size_t)n;
+    }
+    return 1;
+}
+
+/* Map [offset, offset+length) of fd, clamped to file_size.  mmap needs a
+ * page-aligned offset, so the mapping may start up to a page earlier. */
+static int map_range(FastReader *r, int fd, size_t file_size, size_t offset, size_t length) {
+    if (offset > file_size) offset = file_size;
+    if (length > file_size - offset) length = file_size - offset;
+
+    release_input(r);  /* a heap buffer recycled by reset */
+    r->is_mmap = 1;
+    r->data = NULL;
+    r->size = 0;
+    r->map_delta = 0;
+    r->base_offset = offset;
+    if (length == 0) return 1;
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t delta = offset % page;
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (r->populate) flags |= MAP_POPULATE;
+#endif
+    void *map = mmap(NULL, length + delta, PROT_READ, flags, fd, (off_t)(offset - delta));
+    if (map == MAP_FAILED) return 0;
+    madvise(map, length + delta, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (r->huge_pages) madvise(map, length + delta, MADV_HUGEPAGE);
+#endif
+
+    r->data = (const char *)map + delta;
+    r->size = length;
+    r->map_delta = delta;
+    r->advised_to = 0;
+    r->dropped_to = 0;
+    r->advise_at = (r->readahead || r->drop_behind) ? 0 : SIZE_MAX;
+    return 1;
+}
+
+/* Small whole files are copied, everything else is mapped */
+static int load_file(FastReader *r, int fd, size_t file_size, size_t offset, size_t length, int ranged) {
+    if (!ranged && file_size <= SMALL_FILE_MAX)
+        return read_whole(r, fd, file_size);
+    return map_range(r, fd, file_size, offset, length);
+}
+
+/* A loaded file that turns out to be gzip or zstd is inflated into a
+ * streaming window instead; arg then stands in for the source IO */
+static void detect_compressed(FastReader *r, VALUE arg, int ranged) {
+    int format = compress_format(r->data, r->size);
+    if (format == COMPRESS_NONE) return;
+    if (ranged) rb_raise(rb_eArgError, "offset/length can't be used with compressed input");
+
+    inflater_open(r, format);
+    r->io = arg;
+    if (r->prefetch_on) prefetch_start(r, inflater_read, r->inflater, -1);
+}
+
+/* Point a fresh or recycled reader at a path or IO */
+static void open_input(FastReader *r, VALUE arg, size_t offset, size_t length, int ranged) {
+    r->pos = 0;
+    r->scanned_to = 0;
+    r->node_start = 0;
+    r->depth = 0;
+    r->report_depth = 0;
+    r->node_type = 0;
+    r->is_empty = 0;
+    r->name_ptr = NULL;
+    r->name_len = 0;
+    r->prefix_len = 0;
+    r->text_ptr = NULL;
+    r->text_len = 0;
+    r->text_has_entity = 0;
+    r->decoded_text = Qnil;
+    r->attr_count = 0;
+    r->ns_count = 0;
+    r->ns_arena_len = 0;
+    prefetch_stop(r);
+    inflater_free(r);
+    r->io = Qnil;
+    r->io_fd = -1;
+    r->io_eof = 0;
+    r->starved = 0;
+    r->window_offset = 0;
+    r->pin = SIZE_MAX;
+    r->base_offset = 0;
+    r->map_delta = 0;
+    r->advise_at = SIZE_MAX;
+
+    if (RB_TYPE_P(arg, T_STRING)) {
+        /* File path — mmap or read */
+        const char *fpath = StringValueCStr(arg);
+
+        int fd = open(fpath, O_RDONLY);
+        if (fd < 0) rb_sys_fail(fpath);
+
+        struct stat st;
+        if (fstat(fd, &st) < 0) { close(fd); rb_sys_fail(fpath); }
+
+        int ok = load_file(r, fd, (size_t)st.st_size, offset, length, ranged);
+        close(fd);
+        if (!ok) rb_sys_fail(fpath);
+        detect_compressed(r, arg, ranged);
+    } else {
+        /* IO with fd — try mmap first */
+        int use_mmap = 0;
+        int fd = -1;
+
+        if (rb_respond_to(arg, id_fileno)) {
+            VALUE vfd = rb_funcall(arg, id_fileno, 0);
+            if (FIXNUM_P(vfd)) {
+                fd = FIX2INT(vfd);
+                struct stat st;
+                if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                    off_t cur = lseek(fd, 0, SEEK_CUR);
+                    if (cur == 0 && load_file(r, fd, (size_t)st.st_size, offset, length, ranged)) {
+                        use_mmap = 1;
+                    }
+                }
+            }
+        }
+
+        if (!use_mmap) {
+            if (ranged)
+                rb_raise(rb_eArgError, "offset/length require a memory-mappable file");
+            reader_init_from_io(r, arg, fd);
+        } else {
+            detect_compressed(r, arg, ranged);
+        }
+    }
+    /* A stream is checked before its first node is read (see read_node) */
+    if (r->io == Qnil) {
+        detect_encoding(r);
+    } else {
+        set_encoding(r, r->forced_enc ? r->forced_enc : rb_utf8_encoding());
+        r->enc_pending = 1;
+    }
+}
+
+static VALUE reader_initialize(int argc, VALUE *argv, VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    VALUE arg, opts;
+    rb_scan_args(argc, argv, "1:", &arg, &opts);
+
+    size_t offset = 0, length = SIZE_MAX;
+    int ranged = 0;
+
+    r->chunk_size = DEFAULT_CHUNK_SIZE;
+    if (!NIL_P(opts)) {
+        ID keys[15] = { id_chunk_size, id_offset, id_length, id_dedup_values,
+                        id_strip_text, id_keep_blanks, id_cdata, id_namespaces, id_stats,
+                        id_populate, id_huge_pages, id_readahead, id_drop_behind, id_prefetch,
+                        id_encoding };
+        VALUE vals[15];
+        rb_get_kwargs(opts, keys, 0, 15, vals);
+        if (vals[0] != Qundef) {
+            long n = NUM2LONG(vals[0]);
+            if (n <= 0) rb_raise(rb_eArgError, "chunk_size must be positive");
+            r->chunk_size = (size_t)n;
+        }
+        if (vals[1] != Qundef) {
+            long n = NUM2LONG(vals[1]);
+            if (n < 0) rb_raise(rb_eArgError, "offset must not be negative");
+            offset = (size_t)n;
+            ranged = 1;
+        }
+        if (vals[2] != Qundef) {
+            long n = NUM2LONG(vals[2]);
+            if (n < 0) rb_raise(rb_eArgError, "length must not be negative");
+            length = (size_t)n;
+            ranged = 1;
+        }
+        if (vals[3] != Qundef) r->dedup_values = RTEST(vals[3]);
+        if (vals[4] != Qundef) r->strip_text = RTEST(vals[4]);
+        if (vals[5] != Qundef) r->keep_blanks = RTEST(vals[5]);
+        if (vals[6] != Qundef) r->cdata = RTEST(vals[6]);
+        if (vals[7] != Qundef) r->namespaces = RTEST(vals[7]);
+        if (vals[8] != Qundef) r->stats_on = RTEST(vals[8]);
+        if (vals[9] != Qundef) r->populate = RTEST(vals[9]);
+        if (vals[10] != Qundef) r->huge_pages = RTEST(vals[10]);
+        if (vals[11] != Qundef && vals[11] != Qnil) {
+            long n = NUM2LONG(vals[11]);
+            if (n < 0) rb_raise(rb_eArgError, "readahead must not be negative");
+            r->readahead = (size_t)n;
+        }
+        if (vals[12] != Qundef) r->drop_behind = RTEST(vals[12]);
+        if (vals[13] != Qundef) r->prefetch_on = RTEST(vals[13]);
+        if (vals[14] != Qundef && vals[14] != Qnil) {
+            rb_encoding *enc = rb_to_encoding(vals[14]);
+            if (!rb_enc_asciicompat(enc))
+                rb_raise(rb_eArgError, "encoding must be ASCII-compatible");
+            r->forced_enc = enc;
+        }
+    }
+
+    select_scanner(r);
+    open_input(r, arg, offset, length, ranged);
+
+    return self;
+}
+
+/*
+ * reset(path_or_io) — start over on another document, keeping the
+ * interning caches and any heap buffer.  Options from new still apply.
+ */
+static VALUE reader_reset(VALUE self, VALUE arg) {
+    FastReader *r = idle_reader(self);
+
+    if (r->is_mmap) release_input(r);
+    r->size = 0;
+    open_input(r, arg, 0, SIZE_MAX, 0);
+    return self;
+}
+
+static VALUE reader_read(VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    if (reader_read_internal(r)) {
+        return Qtrue;
+    }
+    return Qfalse;
+}
+
+static VALUE reader_skip_subtree(VALUE self) {
+    FastReader *r = idle_reader(self);
+    return skip_subtree_internal(r) ? Qtrue : Qfalse;
+}
+
+static VALUE reader_next_sibling(VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    if (!skip_subtree_internal(r)) return Qfalse;
+    return reader_read_internal(r) ? Qtrue : Qfalse;
+}
+
+/* ------------------------------------------------------------------ */
+/* Raw subtree output                                                 */
+/* The current element's bytes, start tag through end tag, exactly as */
+/* they appear in the input.  skip_subtree finds the end; on a stream */
+/* the window is pinned at the start tag meanwhile so nothing of the  */
+/* element is discarded.                                              */
+/* ------------------------------------------------------------------ */
+/* Spans up to this size are copied into the IO's own write buffer */
+#define SUBTREE_BUFFERED_MAX 8192
+
+typedef struct {
+    FastReader *r;
+    size_t start;
+    int ok;
+} SubtreeSpan;
+
+static VALUE subtree_span_body(VALUE ptr) {
+    SubtreeSpan *sp = (SubtreeSpan *)ptr;
+    FastReader *r = sp->r;
+    r->pin = r->node_start;
+    sp->ok = skip_subtree_internal(r);
+    sp->start = r->pin;
+    return Qnil;
+}
+
+static VALUE subtree_span_done(VALUE ptr) {
+    ((SubtreeSpan *)ptr)->r->pin = SIZE_MAX;
+    return Qnil;
+}
+
+/* Span [*start, pos) of the current element, leaving the reader on its
+ * end tag; 0 off an element or when the document ends inside it */
+static int subtree_span(FastReader *r, size_t *start) {
+    if (r->node_type != TYPE_ELEMENT) return 0;
+    SubtreeSpan sp = { r, 0, 0 };
+    rb_ensure(subtree_span_body, (VALUE)&sp, subtree_span_done, (VALUE)&sp);
+    *start = sp.start;
+    return sp.ok;
+}
+
+/* Raw bytes are in the source encoding, not the one strings are built in */
+static rb_encoding *raw_encoding(const FastReader *r) {
+    return r->transcode ? r->source_enc : r->enc;
+}
+
+typedef struct {
+    int fd;
+    const char *buf;
+    size_t len;
+    ssize_t n;
+    int err;
+} FdWrite;
+
+/* write(2) that waits out EAGAIN on a non-blocking fd */
+static void *fd_write_nogvl(void *ptr) {
+    FdWrite *a = (FdWrite *)ptr;
+    for (;;) {
+        a->n = write(a->fd, a->buf, a->len);
+        if (a->n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) break;
+        struct pollfd pfd = { a->fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, -1) < 0) break;
+    }
+    a->err = errno;
+    return NULL;
+}
+
+/* Write all of [buf, buf+len) to fd without the GVL */
+static void fd_write_all(FastReader *r, int fd, const char *buf, size_t len) {
+    FdWrite a = { fd, buf, len, 0, 0 };
+    r->nogvl = 1;
+    while (a.len > 0) {
+        rb_thread_call_without_gvl(fd_write_nogvl, &a, RUBY_UBF_IO, NULL);
+        if (a.n >= 0) {
+            a.buf += a.n;
+            a.len -= (size_t)a.n;
+            continue;
+        }
+        r->nogvl = 0;
+        if (a.err != EINTR) {
+            errno = a.err;
+            rb_sys_fail("write");
+        }
+        rb_thread_check_ints();
+        r->nogvl = 1;
+    }
+    r->nogvl = 0;
+}
+
+/* outer_xml_slice — the current element's raw bytes as a String, or nil
+ * off an element.  The reader is left on the end tag. */
+static VALUE reader_outer_xml_slice(VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    size_t start;
+    if (!subtree_span(r, &start)) return Qnil;
+    return rb_enc_str_new(r->data + start, (long)(r->pos - start), raw_encoding(r));
+}
+
+/* write_subtree(io) — write the current element's raw bytes to io and
+ * return the byte count, or nil off an element.  Files, pipes and
+ * sockets get small spans through their write buffer and larger ones
+ * with write(2) straight from the input, without the GVL. */
+static VALUE reader_write_subtree(VALUE self, VALUE io) {
+    FastReader *r = idle_reader(self);
+
+    int native = RB_TYPE_P(io, T_FILE);
+    if (native) {
+        rb_io_t *fptr;
+        GetOpenFile(io, fptr);
+        rb_io_check_writable(fptr);
+    }
+
+    size_t start;
+    if (!subtree_span(r, &start)) return Qnil;
+    const char *p = r->data + start;
+    size_t len = r->pos - start;
+    if (!native) {
+        rb_funcall(io, id_write, 1, rb_enc_str_new(p, (long)len, raw_encoding(r)));
+    } else if (len <= SUBTREE_BUFFERED_MAX) {
+        if (rb_io_bufwrite(io, p, len) < 0) rb_sys_fail("write");
+    } else {
+        rb_io_flush(io);
+        fd_write_all(r, NUM2INT(rb_funcall(io, id_fileno, 0)), p, len);
+    }
+    return SIZET2NUM(len);
+}
+
+/* byte_offset — position of the current node in the file or stream */
+static VALUE reader_byte_offset(VALUE self) {
+    FastReader *r = idle_reader(self);
+    return SIZET2NUM(r->base_offset + r->window_offset + r->node_start);
+}
+
+/* encoding — the document's Encoding; strings come back in UTF-8 when
+ * it is a single-byte one, and in it otherwise */
+static VALUE reader_encoding(VALUE self) {
+    FastReader *r = idle_reader(self);
+    return rb_enc_from_encoding(r->source_enc ? r->source_enc : rb_utf8_encoding());
+}
+
+/* seek_to(offset, depth = 0) — resume scanning at a byte offset of the
+ * mapped file, e.g. one recorded with byte_offset. */
+static VALUE reader_seek_to(int argc, VALUE *argv, VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    VALUE voffset, vdepth;
+    rb_scan_args(argc, argv, "11", &voffset, &vdepth);
+
+    if (r->io != Qnil)
+        rb_raise(rb_eIOError, "seek_to requires a file, not a stream");
+
+    long offset = NUM2LONG(voffset);
+    int depth = NIL_P(vdepth) ? 0 : NUM2INT(vdepth);
+    if (offset < (long)r->base_offset || (size_t)offset - r->base_offset > r->size)
+        rb_raise(rb_eArgError, "offset %ld is outside the mapped file", offset);
+    if (depth < 0)
+        rb_raise(rb_eArgError, "depth must not be negative");
+
+    r->pos = r->node_start = r->scanned_to = (size_t)offset - r->base_offset;
+    r->depth = r->report_depth = depth;
+    if (r->advise_at != SIZE_MAX) {
+        /* Hint afresh from the new position on the next scan */
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t at = r->map_delta + r->pos;
+        at -= at % page;
+        if (r->dropped_to > at) r->dropped_to = at;
+        r->advised_to = 0;
+        r->advise_at = r->pos;
+    }
+    r->node_type = 0;
+    r->is_empty = 0;
+    r->name_ptr = NULL;
+    r->name_len = 0;
+    r->text_ptr = NULL;
+    r->text_len = 0;
+    r->attr_count = 0;
+    r->prefix_len = 0;
+    r->decoded_text = Qnil;
+    /* Bindings in scope at the old position say nothing about the new one */
+    r->ns_count = 0;
+    r->ns_arena_len = 0;
+    return self;
 }
 
 static VALUE reader_each(VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    RETURN_ENUMERATOR(self, 0, NULL);
+
+    while (reader_read_internal(r)) {
+        rb_yield(self);
+    }
+
+    return self;
+}
+
+/*
+ * read_batch(n, attributes: false) — advance up to n nodes and return
+ * them column-wise as [types, depths, names, values] (plus an attribute
+ * Hash or nil per node with attributes: true), or nil at end of input.
+ * The reader is left on the last node of the batch.
+ */
+static VALUE reader_read_batch(int argc, VALUE *argv, VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    VALUE vn, opts;
+    rb_scan_args(argc, argv, "1:", &vn, &opts);
+    long n = NUM2LONG(vn);
+    if (n <= 0) rb_raise(rb_eArgError, "batch size must be positive");
+
+    int with_attrs = 0;
+    if (!NIL_P(opts)) {
+        VALUE val;
+        rb_get_kwargs(opts, &id_attributes, 0, 1, &val);
+        if (val != Qundef) with_attrs = RTEST(val);
+    }
+
+    long cap = n < 4096 ? n : 4096;
+    VALUE types = rb_ary_new_capa(cap);
+    VALUE depths = rb_ary_new_capa(cap);
+    VALUE names = rb_ary_new_capa(cap);
+    VALUE values = rb_ary_new_capa(cap);
+    VALUE attrs = with_attrs ? rb_ary_new_capa(cap) : Qnil;
+
+    long i;
+    for (i = 0; i < n && reader_read_internal(r); i++) {
+        rb_ary_push(types, INT2FIX(r->node_type));
+        rb_ary_push(depths, INT2FIX(r->report_depth));
+        rb_ary_push(names, r->name_len ? intern_name(r, r->name_ptr, r->name_len) : Qnil);
+        rb_ary_push(values, node_value(r));
+        if (with_attrs)
+            rb_ary_push(attrs, r->attr_count ? attrs_hash(r) : Qnil);
+    }
+    if (i == 0)
+        return Qnil;
+
+    VALUE batch = rb_ary_new_from_args(4, types, depths, names, values);
+    if (with_attrs) rb_ary_push(batch, attrs);
+    return batch;
+}
+
+/* ------------------------------------------------------------------ */
+/* Element name sets for the bulk C-side filters                      */
+/* ------------------------------------------------------------------ */
+/* Frozen copies of the requested names so a block can't mutate them */
+static VALUE name_list_new(int argc, VALUE *argv) {
+    if (argc == 0)
+        rb_raise(rb_eArgError, "wrong number of arguments (given 0, expected 1+)");
+
+    VALUE names = rb_ary_new2(argc);
+    for (int i = 0; i < argc; i++) {
+        VALUE v = argv[i];
+        if (SYMBOL_P(v)) v = rb_sym_to_s(v);
+        StringValue(v);
+        rb_ary_push(names, rb_str_new_frozen(v));
+    }
+    return names;
+}
+
+/* Copy names into one heap tmp buffer (refs followed by the bytes), so
+ * the refs stay valid while a scan runs without the GVL.  Release with
+ * ALLOCV_END(tmp). */
+static NameRef *name_refs_new(VALUE names, volatile VALUE *tmp) {
+    long count = RARRAY_LEN(names);
+    size_t bytes = sizeof(NameRef) * (size_t)count;
+    for (long i = 0; i < count; i++)
+        bytes += (size_t)RSTRING_LEN(RARRAY_AREF(names, i));
+
+    NameRef *refs = (NameRef *)rb_alloc_tmp_buffer(tmp, (long)bytes);
+    char *buf = (char *)(refs + count);
+    for (long i = 0; i < count; i++) {
+        VALUE v = RARRAY_AREF(names, i);
+        size_t len = (size_t)RSTRING_LEN(v);
+        memcpy(buf, RSTRING_PTR(v), len);
+        refs[i].ptr = buf;
+        refs[i].len = len;
+        buf += len;
+    }
+    return refs;
+}
+
+/* ------------------------------------------------------------------ */
+/* Seek to the next start element matching refs.  On an in-memory    */
+/* document, once NOGVL_THRESHOLD bytes have gone by without a hit    */
+/* the search carries on without the GVL: scan_node touches no Ruby   */
+/* objects when there is no IO to refill from.                        */
+/* ------------------------------------------------------------------ */
+typedef struct {
+    const NameRef *refs;
+    int count;
+    int all;       /* keep going after a match, only counting it */
+    long matches;
+} SeekState;
+
+static inline int is_match(FastReader *r, const NameRef *refs, int count) {
+    return r->node_type == TYPE_ELEMENT && name_refs_match(refs, count, r->name_ptr, r->name_len);
+}
+
+static int seek_step(FastReader *r, void *arg) {
+    SeekState *st = (SeekState *)arg;
+    if (!scan_node(r)) return 0;
+    node_emitted(r);
+    if (is_match(r, st->refs, st->count)) {
+        st->matches++;
+        return st->all;
+    }
+    return 1;
+}
+
+/* Number of matches passed: 0 or 1 unless all is set, in which case
+ * the whole rest of the document is consumed */
+static long seek_element(FastReader *r, const NameRef *refs, int count, int all) {
+    size_t limit = r->pos + NOGVL_THRESHOLD;
+    SeekState st = { refs, count, all, 0 };
+
+    while (reader_read_internal(r)) {
+        if (is_match(r, refs, count)) {
+            st.matches++;
+            if (!all) break;
+        }
+        if (r->pos > limit && r->io == Qnil) {
+            run_without_gvl(r, seek_step, &st);
+            break;
+        }
+    }
+    return st.matches;
+}
+
+/* seek_element with attributes parsed only for start tags named in
+ * attr_names; the filter is lifted however the search ends */
+typedef struct {
     FastReader *r;
-    TypedData_Get_Struct(self, FastReader, &reader_type, r);
+    const NameRef *refs;
+    int count;
+    int all;
+    int attr_name_count;
+    long matches;
+} FilteredSeek;
+
+/* Parse attributes only of start tags named in refs until cleared */
+static void attr_filter_set(FastReader *r, const NameRef *refs, int count) {
+    r->attr_names = refs;
+    r->attr_name_count = count;
+    r->attr_filter = 1;
+}
+
+static void attr_filter_clear(FastReader *r) {
+    r->attr_filter = 0;
+    r->attr_names = NULL;
+    r->attr_name_count = 0;
+}
+
+static VALUE filtered_seek_body(VALUE ptr) {
+    FilteredSeek *fs = (FilteredSeek *)ptr;
+    FastReader *r = fs->r;
+    attr_filter_set(r, fs->refs, fs->attr_name_count);
+    fs->matches = seek_element(r, fs->refs, fs->count, fs->all);
+    return Qnil;
+}
+
+static VALUE filtered_seek_done(VALUE ptr) {
+    attr_filter_clear(((FilteredSeek *)ptr)->r);
+    return Qnil;
+}
+
+static long seek_filtered(FastReader *r, const NameRef *refs, int count, int all, int attr_name_count) {
+    FilteredSeek fs = { r, refs, count, all, attr_name_count, 0 };
+    rb_ensure(filtered_seek_body, (VALUE)&fs, filtered_seek_done, (VALUE)&fs);
+    return fs.matches;
+}
+
+/* each_element(*names) — yield only start elements whose name matches */
+static VALUE reader_each_element(int argc, VALUE *argv, VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    RETURN_ENUMERATOR(self, argc, argv);
+
+    VALUE names = name_list_new(argc, argv);
+    volatile VALUE tmp;
+    NameRef *refs = name_refs_new(names, &tmp);
+
+    while (seek_filtered(r, refs, argc, 0, argc)) {
+        rb_yield(self);
+    }
+
+    ALLOCV_END(tmp);
+    return self;
+}
+
+/* find_first(*names) — advance to the next start element whose name
+ * matches and return self, or nil at the end of the document */
+static VALUE reader_find_first(int argc, VALUE *argv, VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    VALUE names = name_list_new(argc, argv);
+    volatile VALUE tmp;
+    NameRef *refs = name_refs_new(names, &tmp);
+    long found = seek_filtered(r, refs, argc, 0, argc);
+    ALLOCV_END(tmp);
+    return found ? self : Qnil;
+}
+
+/* count_elements(*names) — number of matching start elements between
+ * here and the end of the document, which the reader is left at. No
+ * attributes are parsed along the way. */
+static VALUE reader_count_elements(int argc, VALUE *argv, VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    VALUE names = name_list_new(argc, argv);
+    volatile VALUE tmp;
+    NameRef *refs = name_refs_new(names, &tmp);
+    long count = seek_filtered(r, refs, argc, 1, 0);
+    ALLOCV_END(tmp);
+    return LONG2NUM(count);
+}
+
+/* ------------------------------------------------------------------ */
+/* Path matching                                                      */
+/* A path such as /feed//item[@type='x']/price compiles to a list of  */
+/* steps.  Each open element carries a bitmask of how many leading    */
+/* steps its ancestry satisfies; bit step_count set means a match.     */
+/* Subtrees whose mask has no live bits are skipped unread.           */
+/* ------------------------------------------------------------------ */
+#define PATH_MAX_STEPS 63
+#define PATH_MAX_PREDS 64
 
-    RETURN_ENUMERATOR(self, 0, NULL);
+typedef struct {
+    const char *name;
+    size_t name_len;
+    const char *val;      /* NULL for a bare [@name] existence test */
+    size_t val_len;
+} PathPred;
+
+typedef struct {
+    int descendant;       /* reached through '//' */
+    const char *name;     /* local name; length 0 for '*' */
+    size_t name_len;
+    int pred_start;
+    int pred_count;
+} PathStep;
+
+typedef struct {
+    PathStep steps[PATH_MAX_STEPS];
+    PathPred preds[PATH_MAX_PREDS];
+    int step_count;
+    int pred_count;
+} PathProgram;
+
+static void path_error(VALUE path) {
+    rb_raise(rb_eArgError, "invalid path: %" PRIsVALUE, path);
+}
+
+/* Compile the frozen String path into p; pointers refer into path */
+static void path_compile(PathProgram *p, VALUE path) {
+    const char *s = RSTRING_PTR(path), *e = s + RSTRING_LEN(path);
+    p->step_count = p->pred_count = 0;
+
+    if (s >= e || *s != '/') path_error(path);
+    while (s < e) {
+        if (*s != '/') path_error(path);
+        if (p->step_count == PATH_MAX_STEPS)
+            rb_raise(rb_eArgError, "path has more than %d steps", PATH_MAX_STEPS);
+        PathStep *st = &p->steps[p->step_count++];
+        st->descendant = (s + 1 < e && s[1] == '/');
+        s += st->descendant ? 2 : 1;
+
+        const char *name = s;
+        while (s < e && *s != '/' && *s != '[') s++;
+        if (s == name) path_error(path);
+        if (s - name == 1 && *name == '*') {
+            st->name_len = 0;
+        } else {
+            const char *colon = memchr(name, ':', (size_t)(s - name));
+            if (colon) name = colon + 1;
+            if (s == name) path_error(path);
+            st->name = name;
+            st->name_len = (size_t)(s - name);
+        }
+
+        st->pred_start = p->pred_count;
+        while (s < e && *s == '[') {
+            if (p->pred_count == PATH_MAX_PREDS)
+                rb_raise(rb_eArgError, "path has more than %d predicates", PATH_MAX_PREDS);
+            PathPred *pr = &p->preds[p->pred_count++];
+            if (++s >= e || *s++ != '@') path_error(path);
+            pr->name = s;
+            while (s < e && *s != '=' && *s != ']') s++;
+            pr->name_len = (size_t)(s - pr->name);
+            if (s >= e || pr->name_len == 0) path_error(path);
+            pr->val = NULL;
+            if (*s == '=') {
+                char q = ++s < e ? *s : 0;
+                if (q != '\'' && q != '"') path_error(path);
+                pr->val = ++s;
+                const char *close = memchr(s, q, (size_t)(e - s));
+                if (!close) path_error(path);
+                pr->val_len = (size_t)(close - s);
+                s = close + 1;
+            }
+            if (s >= e || *s++ != ']') path_error(path);
+        }
+        st->pred_count = p->pred_count - st->pred_start;
+    }
+}
+
+static int path_step_matches(const PathProgram *p, const PathStep *st, FastReader *r) {
+    if (st->name_len && (st->name_len != r->name_len || memcmp(st->name, r->name_ptr, st->name_len) != 0))
+        return 0;
+    for (int i = 0; i < st->pred_count; i++) {
+        const PathPred *pr = &p->preds[st->pred_start + i];
+        AttrEntry *a = find_attr_span(r, pr->name, pr->name_len);
+        if (!a) return 0;
+        if (pr->val && !span_equal(a->val_ptr, a->val_len, a->val_has_entity, pr->val, pr->val_len))
+            return 0;
+    }
+    return 1;
+}
+
+/* Mask of the current element given its parent's mask */
+static uint64_t path_advance(const PathProgram *p, FastReader *r, uint64_t parent) {
+    uint64_t next = 0;
+    for (int j = 0; j < p->step_count; j++) {
+        if (!(parent & ((uint64_t)1 << j))) continue;
+        const PathStep *st = &p->steps[j];
+        if (st->descendant) next |= (uint64_t)1 << j;
+        if (path_step_matches(p, st, r)) next |= (uint64_t)1 << (j + 1);
+    }
+    return next;
+}
+
+/*
+ * each_match(path) — yield at each start element matching path.  The
+ * path is anchored at the reader's current depth (the document root for
+ * a fresh reader) and iteration stops when that level is left.  The
+ * block may consume the matched element's children.
+ */
+static VALUE reader_each_match(VALUE self, VALUE path) {
+    FastReader *r = idle_reader(self);
+
+    RETURN_ENUMERATOR(self, 1, &path);
+
+    path = rb_str_new_frozen(StringValue(path));
+    PathProgram prog;
+    path_compile(&prog, path);
+
+    uint64_t hit = (uint64_t)1 << prog.step_count;
+    uint64_t live = hit - 1;
+    int base = r->depth;
+    long cap = 64;
+    volatile VALUE tmp;
+    uint64_t *m = rb_alloc_tmp_buffer(&tmp, cap * (long)sizeof(uint64_t));
+    m[0] = 1;
 
     while (reader_read_internal(r)) {
-        rb_yield(self);
+        if (r->report_depth < base) break;
+        if (r->node_type != TYPE_ELEMENT) continue;
+
+        long d = r->report_depth - base;
+        if (d + 1 >= cap) {
+            volatile VALUE grown;
+            long ncap = cap;
+            while (d + 1 >= ncap) ncap *= 2;
+            uint64_t *nm = rb_alloc_tmp_buffer(&grown, ncap * (long)sizeof(uint64_t));
+            memcpy(nm, m, (size_t)cap * sizeof(uint64_t));
+            rb_free_tmp_buffer(&tmp);
+            tmp = grown;
+            m = nm;
+            cap = ncap;
+        }
+        uint64_t next = path_advance(&prog, r, m[d]);
+        m[d + 1] = next;
+
+        if (next & hit) {
+            size_t pos = r->pos, window = r->window_offset;
+            rb_yield(self);
+            if (r->pos != pos || r->window_offset != window) continue;
+        }
+        if (!r->is_empty && !(next & live))
+            skip_subtree_internal(r);
     }
 
+    ALLOCV_END(tmp);
+    RB_GC_GUARD(path);
     return self;
 }
 
-static VALUE reader_name(VALUE self) {
+/* ------------------------------------------------------------------ */
+/* Event handlers                                                     */
+/* run drives the reader to the end of the document from C and calls  */
+/* the blocks registered with on for each node.  Named handlers are   */
+/* matched on the raw name bytes, so a node nobody listens for costs  */
+/* no Ruby call and no String.  Arguments are passed from C arrays.   */
+/* ------------------------------------------------------------------ */
+#define EVENT_START 0
+#define EVENT_TEXT  1
+#define EVENT_END   2
+
+/* Text handlers are tracked per open element as a bitmask */
+#define MAX_HANDLERS 64
+
+typedef struct {
     FastReader *r;
-    TypedData_Get_Struct(self, FastReader, &reader_type, r);
+    uint64_t *text_masks; /* by report_depth + 1: named text handlers of the open element */
+    long mask_cap;
+    volatile VALUE tmp;
+} Dispatch;
+
+/* Call h with the first of argc arguments it takes */
+static void handler_call(const Handler *h, int argc, const VALUE *argv) {
+    if (h->arity >= 0 && h->arity < argc) argc = h->arity;
+    rb_proc_call_with_block(h->proc, argc, argv, Qnil);
+}
+
+static inline int handler_matches(const Handler *h, int event, const FastReader *r) {
+    return h->event == event &&
+           (!h->name.ptr || name_refs_match(&h->name, 1, r->name_ptr, r->name_len));
+}
+
+/* Named start handlers get (attributes), catch-alls (name, attributes) */
+static void dispatch_start(FastReader *r) {
+    VALUE args[2] = { Qnil, Qnil };
+    int have = 0; /* leading args built so far for a catch-all */
+    VALUE attrs = Qundef;
+
+    for (int i = 0; i < r->handler_count; i++) {
+        const Handler *h = &r->handlers[i];
+        if (!handler_matches(h, EVENT_START, r)) continue;
+        if (h->name.ptr) {
+            if (h->arity != 0 && attrs == Qundef) attrs = attrs_hash(r);
+            handler_call(h, 1, &attrs);
+            continue;
+        }
+        int want = h->arity < 0 || h->arity > 2 ? 2 : h->arity;
+        if (want > 0 && have < 1) {
+            args[0] = intern_name(r, r->name_ptr, r->name_len);
+            have = 1;
+        }
+        if (want > 1 && have < 2) {
+            if (attrs == Qundef) attrs = attrs_hash(r);
+            args[1] = attrs;
+            have = 2;
+        }
+        handler_call(h, 2, args);
+    }
+}
+
+/* Named end handlers get no arguments, catch-alls the name */
+static void dispatch_end(FastReader *r) {
+    VALUE name = Qundef;
+    for (int i = 0; i < r->handler_count; i++) {
+        const Handler *h = &r->handlers[i];
+        if (!handler_matches(h, EVENT_END, r)) continue;
+        if (h->name.ptr) {
+            handler_call(h, 0, NULL);
+            continue;
+        }
+        if (name == Qundef) name = intern_name(r, r->name_ptr, r->name_len);
+        handler_call(h, 1, &name);
+    }
+}
+
+/* Text and CDATA go to catch-alls and to handlers named for the parent */
+static void dispatch_text(FastReader *r, uint64_t parent) {
+    VALUE value = Qundef;
+    for (int i = 0; i < r->handler_count; i++) {
+        const Handler *h = &r->handlers[i];
+        if (h->event != EVENT_TEXT) continue;
+        if (h->name.ptr && !(parent & ((uint64_t)1 << i))) continue;
+        if (value == Qundef) value = node_value(r);
+        handler_call(h, 1, &value);
+    }
+}
+
+/* Record which named text handlers apply inside the current element */
+static void push_text_mask(Dispatch *d) {
+    FastReader *r = d->r;
+    long slot = r->report_depth + 1;
+    if (slot >= d->mask_cap) {
+        long cap = d->mask_cap;
+        while (slot >= cap) cap *= 2;
+        volatile VALUE grown;
+        uint64_t *masks = rb_alloc_tmp_buffer(&grown, cap * (long)sizeof(uint64_t));
+        memcpy(masks, d->text_masks, (size_t)d->mask_cap * sizeof(uint64_t));
+        rb_free_tmp_buffer(&d->tmp);
+        d->tmp = grown;
+        d->text_masks = masks;
+        d->mask_cap = cap;
+    }
+    uint64_t mask = 0;
+    for (int i = 0; i < r->handler_count; i++) {
+        const Handler *h = &r->handlers[i];
+        if (h->event == EVENT_TEXT && h->name.ptr &&
+            name_refs_match(&h->name, 1, r->name_ptr, r->name_len))
+            mask |= (uint64_t)1 << i;
+    }
+    d->text_masks[slot] = mask;
+}
+
+static VALUE dispatch_body(VALUE ptr) {
+    Dispatch *d = (Dispatch *)ptr;
+    FastReader *r = d->r;
+    NameRef starts[MAX_HANDLERS], attr_refs[MAX_HANDLERS];
+    int start_count = 0, attr_count = 0, only_named_starts = 1, named_text = 0, all_attrs = 0;
+
+    for (int i = 0; i < r->handler_count; i++) {
+        const Handler *h = &r->handlers[i];
+        if (h->event != EVENT_START || !h->name.ptr) only_named_starts = 0;
+        if (h->event == EVENT_TEXT && h->name.ptr) named_text = 1;
+        if (h->event == EVENT_START && h->name.ptr) starts[start_count++] = h->name;
+        /* :end handlers of empty elements sit on the start tag too */
+        if (h->event != EVENT_TEXT) {
+            if (h->name.ptr)
+                attr_refs[attr_count++] = h->name;
+            else
+                all_attrs = 1;
+        }
+    }
+
+    /* Attributes are only parsed for elements a handler sees.  The
+     * filter covers the reader's own scans and is lifted while handlers
+     * run, so a handler that reads on gets every attribute. */
+    int filter = !all_attrs;
+
+    /* Start handlers alone: let seek_element pass over everything else */
+    if (only_named_starts) {
+        while (start_count) {
+            if (filter) attr_filter_set(r, attr_refs, attr_count);
+            long found = seek_element(r, starts, start_count, 0);
+            attr_filter_clear(r);
+            if (!found) break;
+            dispatch_start(r);
+        }
+        return Qnil;
+    }
+
+    if (named_text) {
+        d->mask_cap = 64;
+        d->text_masks = rb_alloc_tmp_buffer(&d->tmp, d->mask_cap * (long)sizeof(uint64_t));
+        memset(d->text_masks, 0, (size_t)d->mask_cap * sizeof(uint64_t));
+    }
+    for (;;) {
+        if (filter) attr_filter_set(r, attr_refs, attr_count);
+        int more = reader_read_internal(r);
+        attr_filter_clear(r);
+        if (!more) break;
+
+        switch (r->node_type) {
+        case TYPE_ELEMENT: {
+            int empty = r->is_empty;
+            if (named_text) push_text_mask(d);
+            dispatch_start(r);
+            /* A handler may have skipped to the end tag with skip_subtree */
+            if (empty || r->node_type == TYPE_END_ELEMENT)
+                dispatch_end(r);
+            break;
+        }
+        case TYPE_TEXT:
+        case TYPE_CDATA:
+            dispatch_text(r, named_text && r->report_depth < d->mask_cap
+                                 ? d->text_masks[r->report_depth] : 0);
+            break;
+        case TYPE_END_ELEMENT:
+            dispatch_end(r);
+            break;
+        }
+    }
+    return Qnil;
+}
+
+static VALUE dispatch_done(VALUE ptr) {
+    Dispatch *d = (Dispatch *)ptr;
+    FastReader *r = d->r;
+    attr_filter_clear(r);
+    r->dispatching = 0;
+    if (d->tmp) rb_free_tmp_buffer(&d->tmp);
+    return Qnil;
+}
+
+/*
+ * on(event, name = nil) { ... } — register a block for run.  :start
+ * blocks get (attributes) when named, else (name, attributes); :text
+ * blocks get (value) for text inside an element called name, or for all
+ * text; :end blocks get nothing when named, else (name).  Blocks taking
+ * fewer parameters are passed fewer arguments, and no attribute Hash is
+ * built for a block that takes none.
+ */
+static VALUE reader_on(int argc, VALUE *argv, VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    VALUE vevent, vname, block;
+    rb_scan_args(argc, argv, "11&", &vevent, &vname, &block);
+    if (NIL_P(block)) rb_raise(rb_eArgError, "no block given");
+    if (r->dispatching) rb_raise(rb_eRuntimeError, "can't add handlers while run is dispatching");
+
+    int event;
+    if (vevent == ID2SYM(id_start)) event = EVENT_START;
+    else if (vevent == ID2SYM(id_text)) event = EVENT_TEXT;
+    else if (vevent == ID2SYM(id_end)) event = EVENT_END;
+    else rb_raise(rb_eArgError, "unknown event %+"PRIsVALUE" (expected :start, :text or :end)", vevent);
+    if (!NIL_P(vname)) StringValue(vname);
+    if (r->handler_count == MAX_HANDLERS) rb_raise(rb_eArgError, "at most %d handlers", MAX_HANDLERS);
+
+    REALLOC_N(r->handlers, Handler, r->handler_count + 1);
+    Handler *h = &r->handlers[r->handler_count];
+    h->event = event;
+    h->arity = rb_proc_arity(block);
+    h->proc = block;
+    h->name.ptr = NULL;
+    h->name.len = 0;
+    if (!NIL_P(vname)) {
+        size_t len = (size_t)RSTRING_LEN(vname);
+        char *name = ALLOC_N(char, len ? len : 1);
+        memcpy(name, RSTRING_PTR(vname), len);
+        h->name.ptr = name;
+        h->name.len = len;
+    }
+    r->handler_count++;
+    return self;
+}
+
+/* run — read to the end of the document, calling the on handlers */
+static VALUE reader_run(VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    if (r->dispatching) rb_raise(rb_eRuntimeError, "run is already dispatching");
+    Dispatch d = { r, NULL, 0, 0 };
+    r->dispatching = 1;
+    rb_ensure(dispatch_body, (VALUE)&d, dispatch_done, (VALUE)&d);
+    return self;
+}
+
+/* ------------------------------------------------------------------ */
+/* Subtree materialization                                            */
+/* Attributes and child elements share one Hash keyed by interned     */
+/* names; repeated children collect into an Array.  A child with only */
+/* text becomes a String, an empty one nil, and text next to          */
+/* attributes or children is stored under "__content__".              */
+/* ------------------------------------------------------------------ */
+static VALUE str_content_key;
+
+static void hash_add_child(VALUE hash, VALUE key, VALUE val) {
+    VALUE cur = rb_hash_lookup2(hash, key, Qundef);
+    if (cur == Qundef) {
+        rb_hash_aset(hash, key, val);
+    } else if (RB_TYPE_P(cur, T_ARRAY)) {
+        rb_ary_push(cur, val);
+    } else {
+        rb_hash_aset(hash, key, rb_assoc_new(cur, val));
+    }
+}
+
+static VALUE element_hash_new(FastReader *r) {
+    VALUE hash = rb_hash_new();
+    for (int i = 0; i < r->attr_count; i++) {
+        AttrEntry *a = &r->attrs[i];
+        hash_add_child(hash, intern_name(r, a->name_ptr, a->name_len), make_attr_value(r, a));
+    }
+    return hash;
+}
+
+/* Collapse a finished element to its Hash, String or nil */
+static VALUE element_value(VALUE hash, VALUE text, int top) {
+    if (!top && RHASH_SIZE(hash) == 0)
+        return text;
+    if (text != Qnil)
+        rb_hash_aset(hash, str_content_key, text);
+    return hash;
+}
+
+/* Frames are pushed onto a Ruby Array as [hash, key, text] triples */
+#define FRAME_HASH(stack, top) RARRAY_AREF(stack, (top) * 3)
+#define FRAME_KEY(stack, top)  RARRAY_AREF(stack, (top) * 3 + 1)
+#define FRAME_TEXT(stack, top) RARRAY_AREF(stack, (top) * 3 + 2)
+
+static VALUE reader_read_subtree_hash(VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    if (r->node_type != TYPE_ELEMENT)
+        return Qnil;
+
+    VALUE root = element_hash_new(r);
+    if (r->is_empty)
+        return root;
+
+    VALUE stack = rb_ary_new();
+    rb_ary_push(stack, root);
+    rb_ary_push(stack, Qnil);
+    rb_ary_push(stack, Qnil);
+    long top = 0;
+
+    while (top >= 0 && reader_read_internal(r)) {
+        if (r->node_type == TYPE_ELEMENT) {
+            VALUE key = intern_name(r, r->name_ptr, r->name_len);
+            VALUE hash = element_hash_new(r);
+            if (r->is_empty) {
+                hash_add_child(FRAME_HASH(stack, top), key, RHASH_SIZE(hash) ? hash : Qnil);
+            } else {
+                rb_ary_push(stack, hash);
+                rb_ary_push(stack, key);
+                rb_ary_push(stack, Qnil);
+                top++;
+            }
+        } else if (r->node_type == TYPE_TEXT || r->node_type == TYPE_CDATA) {
+            VALUE text = FRAME_TEXT(stack, top);
+            if (text == Qnil) {
+                rb_ary_store(stack, top * 3 + 2, make_text_value(r));
+            } else {
+                if (OBJ_FROZEN(text)) {  /* deduplicated first segment */
+                    text = rb_str_dup(text);
+                    rb_ary_store(stack, top * 3 + 2, text);
+                }
+                rb_str_append(text, make_text_value(r));
+            }
+        } else if (r->node_type == TYPE_END_ELEMENT) {
+            VALUE val = element_value(FRAME_HASH(stack, top), FRAME_TEXT(stack, top), top == 0);
+            VALUE key = FRAME_KEY(stack, top);
+            rb_ary_resize(stack, top * 3);
+            if (--top >= 0)
+                hash_add_child(FRAME_HASH(stack, top), key, val);
+        }
+    }
+
+    /* Truncated document: fold whatever is still open into its parent */
+    while (top >= 0) {
+        VALUE val = element_value(FRAME_HASH(stack, top), FRAME_TEXT(stack, top), top == 0);
+        VALUE key = FRAME_KEY(stack, top);
+        if (--top >= 0)
+            hash_add_child(FRAME_HASH(stack, top), key, val);
+    }
+
+    return root;
+}
+
+/* ------------------------------------------------------------------ */
+/* Record partitioning for parallel readers                           */
+/* Boundaries are found by a plain scan for the literal start tag, so */
+/* records must not nest or appear inside comments/CDATA.             */
+/* ------------------------------------------------------------------ */
+static const char *start_tag_span(const char *p, const char *limit, const char *end, void *arg) {
+    const NameRef *name = (const NameRef *)arg;
+    while (p < limit) {
+        const char *lt = memchr(p, '<', (size_t)(limit - p));
+        if (!lt) return NULL;
+        if ((size_t)(end - lt) > name->len + 1 && memcmp(lt + 1, name->ptr, name->len) == 0 &&
+            (char_class[(unsigned char)lt[1 + name->len]] & CC_NAME_END)) {
+            return lt;
+        }
+        p = lt + 1;
+    }
+    return NULL;
+}
+
+static const char *find_start_tag(FastReader *r, const char *p, const char *end, const NameRef *name) {
+    return scan_span(r, start_tag_span, p, end, (void *)name);
+}
+
+/* End of the last "</name>" in (start, end), or NULL */
+static const char *find_last_end_tag(const char *start, const char *end, const char *name, size_t nlen) {
+    for (const char *q = end - 1; q > start; q--) {
+        if (*q != '<') continue;
+        const char *n = q + 2;
+        if (n + nlen <= end && q[1] == '/' && memcmp(n, name, nlen) == 0 &&
+            (n + nlen == end || n[nlen] == '>' || (char_class[(unsigned char)n[nlen]] & CC_SPACE))) {
+            const char *gt = memchr(n, '>', (size_t)(end - n));
+            return gt ? gt + 1 : end;
+        }
+    }
+    return NULL;
+}
+
+/* split_records(name, n) — up to n [offset, length] ranges of whole records */
+static VALUE reader_split_records(VALUE self, VALUE vname, VALUE vcount) {
+    FastReader *r = idle_reader(self);
+
+    StringValue(vname);
+    long count = NUM2LONG(vcount);
+    if (count < 1) rb_raise(rb_eArgError, "count must be positive");
+    if (r->io != Qnil) rb_raise(rb_eIOError, "split_records requires a file, not a stream");
+
+    VALUE ranges = rb_ary_new();
+    if (!r->data || RSTRING_LEN(vname) == 0) return ranges;
+
+    /* Copied: the scans below may run without the GVL */
+    volatile VALUE tmp;
+    NameRef *ref = name_refs_new(rb_ary_new_from_args(1, vname), &tmp);
+    const char *name = ref->ptr;
+    size_t nlen = ref->len;
+
+    const char *end = r->data + r->size;
+    const char *first = find_start_tag(r, r->data, end, ref);
+    if (!first) {
+        ALLOCV_END(tmp);
+        return ranges;
+    }
+    const char *stop = find_last_end_tag(first, end, name, nlen);
+    if (!stop) stop = end;
+
+    const char *start = first;
+    for (long i = 1; i <= count; i++) {
+        const char *cut = stop;
+        if (i < count) {
+            const char *target = r->data + (size_t)((double)r->size * i / count);
+            if (target <= start) continue;
+            cut = find_start_tag(r, target, stop, ref);
+            if (!cut) cut = stop;
+        }
+        if (cut <= start) continue;
+        rb_ary_push(ranges, rb_assoc_new(SIZET2NUM(r->base_offset + (size_t)(start - r->data)),
+                                         SIZET2NUM((size_t)(cut - start))));
+        start = cut;
+        if (start >= stop) break;
+    }
+    ALLOCV_END(tmp);
+    return ranges;
+}
+
+static VALUE reader_name(VALUE self) {
+    FastReader *r = idle_reader(self);
 
     if (r->name_ptr == NULL || r->name_len == 0)
         return Qnil;
@@ -801,70 +4011,247 @@ static VALUE reader_name(VALUE self) {
     return intern_name(r, r->name_ptr, r->name_len);
 }
 
+static VALUE reader_prefix(VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    if (r->prefix_len == 0)
+        return Qnil;
+    return intern_name(r, r->prefix_ptr, r->prefix_len);
+}
+
+static const char XML_NS_URI[] = "http://www.w3.org/XML/1998/namespace";
+
+/* Binding in scope for the current element or end element, or NULL */
+static const NsBinding *current_ns(FastReader *r, const char **uri, size_t *ulen) {
+    if (r->node_type != TYPE_ELEMENT && r->node_type != TYPE_END_ELEMENT)
+        return NULL;
+    if (r->prefix_len == 3 && memcmp(r->prefix_ptr, "xml", 3) == 0) {
+        *uri = XML_NS_URI;
+        *ulen = sizeof(XML_NS_URI) - 1;
+        return NULL;
+    }
+    const NsBinding *b = ns_lookup(r, r->prefix_ptr, r->prefix_len);
+    if (b) {
+        *uri = r->ns_arena + b->off + b->prefix_len;
+        *ulen = b->uri_len;
+    }
+    return b;
+}
+
+/* namespace_uri — URI bound to the element's prefix (namespaces: true) */
+static VALUE reader_namespace_uri(VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    const char *uri = NULL;
+    size_t ulen = 0;
+    const NsBinding *b = current_ns(r, &uri, &ulen);
+    if (!uri)
+        return Qnil;
+    if (b && b->uri_has_entity) {
+        transcode_span(r, &uri, &ulen);
+        return rb_str_freeze(decode_entities(r, uri, ulen));
+    }
+    return intern_name(r, uri, ulen);
+}
+
+/* expanded_name — interned "{uri}local", or the local name outside any namespace */
+static VALUE reader_expanded_name(VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    if (r->name_len == 0)
+        return Qnil;
+    const char *uri = NULL;
+    size_t ulen = 0;
+    current_ns(r, &uri, &ulen);
+    if (!uri)
+        return intern_name(r, r->name_ptr, r->name_len);
+
+    size_t len = ulen + r->name_len + 2;
+    volatile VALUE tmp = 0;
+    char *buf = ALLOCV(tmp, len);
+    buf[0] = '{';
+    memcpy(buf + 1, uri, ulen);
+    buf[ulen + 1] = '}';
+    memcpy(buf + ulen + 2, r->name_ptr, r->name_len);
+    VALUE name = intern_name(r, buf, len);
+    ALLOCV_END(tmp);
+    return name;
+}
+
 static VALUE reader_node_type(VALUE self) {
-    FastReader *r;
-    TypedData_Get_Struct(self, FastReader, &reader_type, r);
+    FastReader *r = idle_reader(self);
     return INT2FIX(r->node_type);
 }
 
 static VALUE reader_depth(VALUE self) {
-    FastReader *r;
-    TypedData_Get_Struct(self, FastReader, &reader_type, r);
+    FastReader *r = idle_reader(self);
     return INT2FIX(r->report_depth);
 }
 
 static VALUE reader_value(VALUE self) {
-    FastReader *r;
-    TypedData_Get_Struct(self, FastReader, &reader_type, r);
+    FastReader *r = idle_reader(self);
+    return node_value(r);
+}
+
+/* Compare the current text to str byte-for-byte without allocating */
+static VALUE reader_value_eq_p(VALUE self, VALUE str) {
+    FastReader *r = idle_reader(self);
+
+    StringValue(str);
+    if (!has_value(r))
+        return Qfalse;
+    const char *p = r->text_ptr;
+    size_t len = r->text_len;
+    transcode_span(r, &p, &len);
+    return span_equal(p, len, r->text_has_entity,
+                      RSTRING_PTR(str), (size_t)RSTRING_LEN(str)) ? Qtrue : Qfalse;
+}
+
+static VALUE text_as(VALUE self, typed_parser fn) {
+    FastReader *r = idle_reader(self);
 
     if (r->text_ptr == NULL || r->text_len == 0)
         return Qnil;
+    return parse_span(r, r->text_ptr, r->text_len, r->text_has_entity, fn);
+}
 
-    if (r->text_has_entity) {
-        if (r->decoded_text == Qnil) {
-            r->decoded_text = decode_entities(r, r->text_ptr, r->text_len);
-        }
-        return r->decoded_text;
-    }
+static VALUE reader_value_as_integer(VALUE self) { return text_as(self, parse_integer); }
+static VALUE reader_value_as_float(VALUE self) { return text_as(self, parse_float); }
+static VALUE reader_value_as_boolean(VALUE self) { return text_as(self, parse_boolean); }
+static VALUE reader_value_as_time(VALUE self) { return text_as(self, parse_time); }
 
-    return rb_enc_str_new(r->text_ptr, (long)r->text_len, r->utf8);
+static AttrEntry *find_attr(FastReader *r, VALUE attr_name) {
+    StringValue(attr_name);
+    return find_attr_span(r, RSTRING_PTR(attr_name), (size_t)RSTRING_LEN(attr_name));
 }
 
 static VALUE reader_attribute(VALUE self, VALUE attr_name) {
-    FastReader *r;
-    TypedData_Get_Struct(self, FastReader, &reader_type, r);
+    FastReader *r = idle_reader(self);
 
-    const char *needle = StringValuePtr(attr_name);
-    long needle_len = RSTRING_LEN(attr_name);
+    AttrEntry *a = find_attr(r, attr_name);
+    return a ? make_attr_value(r, a) : Qnil;
+}
 
-    for (int i = 0; i < r->attr_count; i++) {
-        AttrEntry *a = &r->attrs[i];
-        if ((long)a->name_len == needle_len && memcmp(a->name_ptr, needle, (size_t)needle_len) == 0) {
-            return make_attr_value(r, a);
-        }
-    }
+/* Compare an attribute value to str without allocating; false if absent */
+static VALUE reader_attribute_eq_p(VALUE self, VALUE attr_name, VALUE str) {
+    FastReader *r = idle_reader(self);
 
-    return Qnil;
+    AttrEntry *a = find_attr(r, attr_name);
+    StringValue(str);
+    if (!a)
+        return Qfalse;
+    const char *p = a->val_ptr;
+    size_t len = a->val_len;
+    transcode_span(r, &p, &len);
+    return span_equal(p, len, a->val_has_entity,
+                      RSTRING_PTR(str), (size_t)RSTRING_LEN(str)) ? Qtrue : Qfalse;
+}
+
+static VALUE attribute_as(VALUE self, VALUE attr_name, typed_parser fn) {
+    FastReader *r = idle_reader(self);
+
+    AttrEntry *a = find_attr(r, attr_name);
+    if (!a)
+        return Qnil;
+    return parse_span(r, a->val_ptr, a->val_len, a->val_has_entity, fn);
+}
+
+static VALUE reader_attribute_as_integer(VALUE self, VALUE name) { return attribute_as(self, name, parse_integer); }
+static VALUE reader_attribute_as_float(VALUE self, VALUE name) { return attribute_as(self, name, parse_float); }
+
+static VALUE reader_attribute_count(VALUE self) {
+    FastReader *r = idle_reader(self);
+    return INT2FIX(r->attr_count);
+}
+
+static VALUE reader_attribute_at(VALUE self, VALUE vindex) {
+    FastReader *r = idle_reader(self);
+
+    long i = NUM2LONG(vindex);
+    if (i < 0 || i >= r->attr_count)
+        return Qnil;
+    return make_attr_value(r, &r->attrs[i]);
+}
+
+/* All attributes as a Hash keyed by interned names */
+static VALUE reader_attributes(VALUE self) {
+    FastReader *r = idle_reader(self);
+    return attrs_hash(r);
 }
 
 static VALUE reader_empty_element_p(VALUE self) {
+    FastReader *r = idle_reader(self);
+    return r->is_empty ? Qtrue : Qfalse;
+}
+
+static VALUE str_cache_stats(const StrCache *c) {
+    VALUE h = rb_hash_new();
+    rb_hash_aset(h, ID2SYM(rb_intern("hits")), SIZET2NUM(c->hits));
+    rb_hash_aset(h, ID2SYM(rb_intern("misses")), SIZET2NUM(c->misses));
+    rb_hash_aset(h, ID2SYM(rb_intern("overflows")), SIZET2NUM(c->overflows));
+    rb_hash_aset(h, ID2SYM(rb_intern("size")), SIZET2NUM(c->count));
+    rb_hash_aset(h, ID2SYM(rb_intern("capacity")), SIZET2NUM(c->capacity));
+    return h;
+}
+
+static VALUE reader_cache_stats(VALUE self) {
     FastReader *r;
     TypedData_Get_Struct(self, FastReader, &reader_type, r);
-    return r->is_empty ? Qtrue : Qfalse;
+    return str_cache_stats(&r->name_cache);
 }
 
-static VALUE reader_close(VALUE self) {
+static VALUE reader_value_cache_stats(VALUE self) {
     FastReader *r;
     TypedData_Get_Struct(self, FastReader, &reader_type, r);
+    return str_cache_stats(&r->value_cache);
+}
 
-    if (r->data) {
-        if (r->is_mmap)
-            munmap((void *)r->data, r->size);
-        else
-            xfree((void *)r->data);
-        r->data = NULL;
-        r->size = 0;
-    }
+#define STAT_SET(h, key, v) rb_hash_aset(h, ID2SYM(rb_intern(key)), SIZET2NUM(v))
+
+/* stats — counters collected with stats: true, or nil */
+static VALUE reader_stats(VALUE self) {
+    FastReader *r;
+    TypedData_Get_Struct(self, FastReader, &reader_type, r);
+
+    if (!r->stats_on)
+        return Qnil;
+    const ReaderStats *st = &r->stats;
+
+    VALUE nodes = rb_hash_new();
+    STAT_SET(nodes, "element", st->elements);
+    STAT_SET(nodes, "text", st->texts);
+    STAT_SET(nodes, "cdata", st->cdata);
+    STAT_SET(nodes, "end_element", st->end_elements);
+
+    VALUE cycles = rb_hash_new();
+    rb_hash_aset(cycles, ID2SYM(rb_intern("scan")), ULL2NUM(st->cycles[PHASE_SCAN]));
+    rb_hash_aset(cycles, ID2SYM(rb_intern("attrs")), ULL2NUM(st->cycles[PHASE_ATTRS]));
+    rb_hash_aset(cycles, ID2SYM(rb_intern("decode")), ULL2NUM(st->cycles[PHASE_DECODE]));
+    rb_hash_aset(cycles, ID2SYM(rb_intern("skip")), ULL2NUM(st->cycles[PHASE_SKIP]));
+
+    VALUE h = rb_hash_new();
+    rb_hash_aset(h, ID2SYM(rb_intern("nodes")), nodes);
+    STAT_SET(h, "bytes_scanned", st->bytes_scanned);
+    STAT_SET(h, "bytes_skipped", st->bytes_skipped);
+    STAT_SET(h, "bytes_rescanned", st->bytes_rescanned);
+    STAT_SET(h, "entity_decodes", st->entity_decodes);
+    STAT_SET(h, "attr_overflows", st->attr_overflows);
+    STAT_SET(h, "collapsed_empty", st->collapsed_empty);
+    STAT_SET(h, "intern_hits", r->name_cache.hits);
+    STAT_SET(h, "intern_misses", r->name_cache.misses);
+    rb_hash_aset(h, ID2SYM(rb_intern("cycles")), cycles);
+    return h;
+}
+
+static VALUE reader_close(VALUE self) {
+    FastReader *r = idle_reader(self);
+
+    prefetch_stop(r);
+    inflater_free(r);
+    release_input(r);
+    r->io = Qnil;
+    r->io_fd = -1;
+    r->io_eof = 1;
     return Qnil;
 }
 
@@ -872,22 +4259,106 @@ static VALUE reader_close(VALUE self) {
 /* Init                                                               */
 /* ------------------------------------------------------------------ */
 void Init_fast_xml_reader(void) {
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+    /* All mutable state, transcoding tables included, lives in
+     * FastReader; readers over split_records ranges can run in parallel
+     * Ractors. */
+    rb_ext_ractor_safe(true);
+#endif
+
+#if defined(SIMD_AVX2)
+    __builtin_cpu_init();
+    have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
     rb_cFastXmlReader = rb_define_class("FastXmlReader", rb_cObject);
     rb_define_alloc_func(rb_cFastXmlReader, reader_alloc);
 
-    rb_define_method(rb_cFastXmlReader, "initialize", reader_initialize, 1);
+    id_read = rb_intern("read");
+    id_write = rb_intern("write");
+    id_fileno = rb_intern("fileno");
+    id_chunk_size = rb_intern("chunk_size");
+    id_offset = rb_intern("offset");
+    id_length = rb_intern("length");
+    id_dedup_values = rb_intern("dedup_values");
+    id_strip_text = rb_intern("strip_text");
+    id_keep_blanks = rb_intern("keep_blanks");
+    id_cdata = rb_intern("cdata");
+    id_attributes = rb_intern("attributes");
+    id_namespaces = rb_intern("namespaces");
+    id_stats = rb_intern("stats");
+    id_populate = rb_intern("populate");
+    id_huge_pages = rb_intern("huge_pages");
+    id_readahead = rb_intern("readahead");
+    id_drop_behind = rb_intern("drop_behind");
+    id_prefetch = rb_intern("prefetch");
+    id_encoding = rb_intern("encoding");
+    id_start = rb_intern("start");
+    id_text = rb_intern("text");
+    id_end = rb_intern("end");
+
+    str_content_key = rb_obj_freeze(rb_enc_str_new("__content__", 11, rb_utf8_encoding()));
+    rb_gc_register_mark_object(str_content_key);
+
+    rb_define_method(rb_cFastXmlReader, "initialize", reader_initialize, -1);
+    rb_define_method(rb_cFastXmlReader, "reset", reader_reset, 1);
     rb_define_method(rb_cFastXmlReader, "read", reader_read, 0);
+    rb_define_method(rb_cFastXmlReader, "read_batch", reader_read_batch, -1);
+    rb_define_method(rb_cFastXmlReader, "byte_offset", reader_byte_offset, 0);
+    rb_define_method(rb_cFastXmlReader, "encoding", reader_encoding, 0);
+    rb_define_method(rb_cFastXmlReader, "seek_to", reader_seek_to, -1);
+    rb_define_method(rb_cFastXmlReader, "skip_subtree", reader_skip_subtree, 0);
+    rb_define_method(rb_cFastXmlReader, "next_sibling", reader_next_sibling, 0);
+    rb_define_method(rb_cFastXmlReader, "outer_xml_slice", reader_outer_xml_slice, 0);
+    rb_define_method(rb_cFastXmlReader, "write_subtree", reader_write_subtree, 1);
     rb_define_method(rb_cFastXmlReader, "each", reader_each, 0);
+    rb_define_method(rb_cFastXmlReader, "each_element", reader_each_element, -1);
+    rb_define_method(rb_cFastXmlReader, "each_match", reader_each_match, 1);
+    rb_define_method(rb_cFastXmlReader, "on", reader_on, -1);
+    rb_define_method(rb_cFastXmlReader, "run", reader_run, 0);
+    rb_define_method(rb_cFastXmlReader, "find_first", reader_find_first, -1);
+    rb_define_method(rb_cFastXmlReader, "count_elements", reader_count_elements, -1);
     rb_define_method(rb_cFastXmlReader, "name", reader_name, 0);
+    rb_define_method(rb_cFastXmlReader, "local_name", reader_name, 0);
+    rb_define_method(rb_cFastXmlReader, "prefix", reader_prefix, 0);
+    rb_define_method(rb_cFastXmlReader, "namespace_uri", reader_namespace_uri, 0);
+    rb_define_method(rb_cFastXmlReader, "expanded_name", reader_expanded_name, 0);
     rb_define_method(rb_cFastXmlReader, "node_type", reader_node_type, 0);
     rb_define_method(rb_cFastXmlReader, "depth", reader_depth, 0);
     rb_define_method(rb_cFastXmlReader, "value", reader_value, 0);
+    rb_define_method(rb_cFastXmlReader, "value_eq?", reader_value_eq_p, 1);
+    rb_define_method(rb_cFastXmlReader, "value_as_integer", reader_value_as_integer, 0);
+    rb_define_method(rb_cFastXmlReader, "value_as_float", reader_value_as_float, 0);
+    rb_define_method(rb_cFastXmlReader, "value_as_boolean", reader_value_as_boolean, 0);
+    rb_define_method(rb_cFastXmlReader, "value_as_time", reader_value_as_time, 0);
     rb_define_method(rb_cFastXmlReader, "attribute", reader_attribute, 1);
+    rb_define_method(rb_cFastXmlReader, "attribute_eq?", reader_attribute_eq_p, 2);
+    rb_define_method(rb_cFastXmlReader, "attribute_as_integer", reader_attribute_as_integer, 1);
+    rb_define_method(rb_cFastXmlReader, "attribute_as_float", reader_attribute_as_float, 1);
+    rb_define_method(rb_cFastXmlReader, "attribute_at", reader_attribute_at, 1);
+    rb_define_method(rb_cFastXmlReader, "attribute_count", reader_attribute_count, 0);
+    rb_define_method(rb_cFastXmlReader, "attributes", reader_attributes, 0);
+    rb_define_method(rb_cFastXmlReader, "read_subtree_hash", reader_read_subtree_hash, 0);
+    rb_define_method(rb_cFastXmlReader, "split_records", reader_split_records, 2);
     rb_define_method(rb_cFastXmlReader, "empty_element?", reader_empty_element_p, 0);
     rb_define_method(rb_cFastXmlReader, "self_closing?", reader_empty_element_p, 0);
+    rb_define_method(rb_cFastXmlReader, "cache_stats", reader_cache_stats, 0);
+    rb_define_method(rb_cFastXmlReader, "value_cache_stats", reader_value_cache_stats, 0);
+    rb_define_method(rb_cFastXmlReader, "stats", reader_stats, 0);
     rb_define_method(rb_cFastXmlReader, "close", reader_close, 0);
 
     rb_define_const(rb_cFastXmlReader, "TYPE_ELEMENT", INT2FIX(TYPE_ELEMENT));
     rb_define_const(rb_cFastXmlReader, "TYPE_TEXT", INT2FIX(TYPE_TEXT));
+    rb_define_const(rb_cFastXmlReader, "TYPE_CDATA", INT2FIX(TYPE_CDATA));
     rb_define_const(rb_cFastXmlReader, "TYPE_END_ELEMENT", INT2FIX(TYPE_END_ELEMENT));
+
+    /* Compressed input formats this build can inflate */
+    VALUE formats = rb_ary_new();
+#ifdef HAVE_LIBZ
+    rb_ary_push(formats, rb_obj_freeze(rb_str_new_cstr("gzip")));
+#endif
+#ifdef HAVE_LIBZSTD
+    rb_ary_push(formats, rb_obj_freeze(rb_str_new_cstr("zstd")));
+#endif
+    rb_define_const(rb_cFastXmlReader, "COMPRESSION_FORMATS", rb_obj_freeze(formats));
 }
@@ -1,3 +1,29 @@
 # frozen_string_literal: true
 
 require 'fast_xml_reader/fast_xml_reader'
+require 'fast_xml_reader/index'
+
+class FastXmlReader
+  # Yields one reader per path, reusing it with #reset so the name and
+  # value caches stay warm and small files share one read buffer.
+  #
+  #   FastXmlReader.each_file(Dir['inbox/*.xml']) do |reader, path|
+  #     reader.each_element('order') { |r| ... }
+  #   end
+  def self.each_file(paths, **options)
+    return enum_for(:each_file, paths, **options) unless block_given?
+
+    reader = nil
+    paths.each do |path|
+      if reader
+        reader.reset(path)
+      else
+        reader = new(path, **options)
+      end
+      yield reader, path
+    end
+    nil
+  ensure
+    reader.close if reader
+  end
+end
@@ -0,0 +1,118 @@
+# frozen_string_literal: true
+
+class FastXmlReader
+  # Maps the value of one attribute of one kind of element to the byte
+  # offset and depth of that element, so single records of a large file
+  # can be reached with FastXmlReader#seek_to instead of a full rescan.
+  #
+  #   index = FastXmlReader::Index.build('catalog.xml', 'product', 'id')
+  #   index.save('catalog.xml.fxri')
+  #
+  #   index = FastXmlReader::Index.load('catalog.xml.fxri')
+  #   reader = FastXmlReader.new('catalog.xml')
+  #   index.seek(reader, '12345') and reader.read_subtree_hash
+  #
+  # The sidecar file is binary: a header naming the element, attribute and
+  # the size/mtime of the indexed file, followed by one
+  # (key length, key, offset, depth) entry per record.
+  class Index
+    MAGIC = 'FXRI1'
+    HEADER = 'Q>Q>N'
+    ENTRY = 'Q>N'
+
+    attr_reader :element, :attribute, :file_size, :file_mtime
+
+    # Scans path once, skipping the inside of every matching element.
+    def self.build(path, element, attribute)
+      stat = File.stat(path)
+      entries = {}
+      reader = FastXmlReader.new(path)
+      begin
+        reader.each_element(element) do |node|
+          key = node.attribute(attribute)
+          entries[key] = [node.byte_offset, node.depth] if key && !entries.key?(key)
+          node.skip_subtree
+        end
+      ensure
+        reader.close
+      end
+      new(element, attribute, entries, stat.size, stat.mtime.to_i)
+    end
+
+    def self.load(index_path)
+      File.open(index_path, 'rb') do |f|
+        raise ArgumentError, "#{index_path} is not a FastXmlReader index" unless f.read(MAGIC.bytesize) == MAGIC
+
+        element = read_string(f)
+        attribute = read_string(f)
+        size, mtime, count = f.read(20).unpack(HEADER)
+        entries = {}
+        count.times do
+          key = read_string(f)
+          entries[key] = f.read(12).unpack(ENTRY)
+        end
+        new(element, attribute, entries, size, mtime)
+      end
+    end
+
+    def self.read_string(io)
+      len = io.read(4).unpack('N').first
+      io.read(len).force_encoding(Encoding::UTF_8)
+    end
+    private_class_method :read_string
+
+    def initialize(element, attribute, entries, file_size, file_mtime)
+      @element = element
+      @attribute = attribute
+      @entries = entries
+      @file_size = file_size
+      @file_mtime = file_mtime
+    end
+
+    def save(index_path)
+      File.open(index_path, 'wb') do |f|
+        f.write(MAGIC)
+        write_string(f, @element)
+        write_string(f, @attribute)
+        f.write([@file_size, @file_mtime, @entries.size].pack(HEADER))
+        @entries.each do |key, (offset, depth)|
+          write_string(f, key)
+          f.write([offset, depth].pack(ENTRY))
+        end
+      end
+      self
+    end
+
+    # [offset, depth] of the element whose attribute equals key, or nil.
+    def [](key)
+      @entries[key]
+    end
+
+    def size
+      @entries.size
+    end
+
+    # True if path still has the size and mtime it had when indexed.
+    def fresh?(path)
+      stat = File.stat(path)
+      stat.size == @file_size && stat.mtime.to_i == @file_mtime
+    end
+
+    # Positions reader on the indexed element; false if key is unknown.
+    def seek(reader, key)
+      offset, depth = @entries[key]
+      return false unless offset
+
+      reader.seek_to(offset, depth)
+      reader.read
+    end
+
+    private
+
+    def write_string(io, str)
+      str = str.b
+      io.write([str.bytesize].pack('N'))
+      io.write(str)
+    end
+  end
+end
@@ -3,6 +3,7 @@
 require 'minitest/autorun'
 require 'stringio'
 require 'tempfile'
+require 'zlib'
 require 'fast_xml_reader'
 
 class TestFastXmlReader < Minitest::Test
@@ -65,6 +66,233 @@ class TestFastXmlReader < Minitest::Test
     assert_includes names, 'a'
   end
 
+  def test_each_element_yields_matching_start_elements
+    r = reader_for('<feed><product id="1">a</product><other/><product id="2"/></feed>')
+    ids = []
+    r.each_element('product') do |n|
+      assert_equal FastXmlReader::TYPE_ELEMENT, n.node_type
+      ids << n.attribute('id')
+    end
+    assert_equal %w[1 2], ids
+  end
+
+  def test_each_element_multiple_names
+    r = reader_for('<feed><a/><b/><c/><ns:b/></feed>')
+    assert_equal %w[a b b], r.each_element('a', :b).map(&:name)
+  end
+
+  def test_each_element_block_can_consume_children
+    r = reader_for('<feed><item><name>x</name></item><item><name>y</name></item></feed>')
+    values = []
+    r.each_element('item') do |n|
+      n.read # <name>
+      n.read # text
+      values << n.value
+    end
+    assert_equal %w[x y], values
+  end
+
+  def test_each_element_requires_a_name
+    assert_raises(ArgumentError) { reader_for('<a/>').each_element {} }
+  end
+
+  def test_find_first_positions_reader
+    r = reader_for('<feed><item/><header version="2" a=">"><x/></header><header version="3"/></feed>')
+    assert_same r, r.find_first('header')
+    assert_equal '2', r.attribute('version')
+    r.read
+    assert_equal 'x', r.name
+    assert_equal '3', r.find_first(:header).attribute('version')
+    assert_nil r.find_first('header')
+  end
+
+  def test_count_elements
+    xml = '<feed><item a="/>"/><item><item>t</item></item><ns:item/><other b=\'>\'/></feed>'
+    assert_equal 4, reader_for(xml).count_elements('item')
+    assert_equal 5, reader_for(xml).count_elements('item', 'other')
+    r = reader_for(xml)
+    r.read
+    assert_equal 0, r.count_elements('feed')
+    refute r.read
+  end
+
+  def test_find_first_parses_attributes_of_later_reads
+    r = reader_for('<a><b x="1"/><c y="2"/></a>')
+    r.find_first('c')
+    assert_equal '2', r.attribute('y')
+    r = reader_for('<a><b x="1"/><c y="2"/></a>')
+    r.find_first('a')
+    r.read
+    assert_equal '1', r.attribute('x')
+  end
+
+  def test_read_batch_columns
+    r = reader_for('<a><b id="1">x &amp; y</b><c/></a>')
+    types, depths, names, values = r.read_batch(3)
+    assert_equal [1, 1, 3], types
+    assert_equal [0, 1, 2], depths
+    assert_equal ['a', 'b', nil], names
+    assert_equal [nil, nil, 'x & y'], values
+
+    types, _, names, = r.read_batch(10)
+    assert_equal [15, 1, 15], types
+    assert_equal %w[b c a], names
+    assert_nil r.read_batch(10)
+  end
+
+  def test_read_batch_attributes_and_reader_position
+    r = reader_for('<a><b id="1"/><c/></a>')
+    batch = r.read_batch(2, attributes: true)
+    assert_equal 5, batch.size
+    assert_equal [nil, { 'id' => '1' }], batch[4]
+    assert_equal 'b', r.name
+    r.read
+    assert_equal 'c', r.name
+  end
+
+  def test_read_batch_matches_each
+    expected = nodes_from(reader_for(STREAM_XML)).map { |n| [n[:type], n[:depth], n[:name], n[:value]] }
+    r = FastXmlReader.new(StringIO.new(STREAM_XML), chunk_size: 7)
+    got = []
+    while (batch = r.read_batch(4))
+      got.concat(batch[0].zip(*batch[1..3]))
+    end
+    assert_equal expected, got
+  end
+
+  MATCH_XML = '<feed><items>' \
+              '<item type="x"><price>1</price><sku>a</sku></item>' \
+              '<item type="y"><price>2</price></item>' \
+              '<group><item type="x"><price>3</price></item></group>' \
+              '<item type="x &amp; z"><price>4</price></item>' \
+              '</items><price>5</price></feed>'
+
+  def match_values(path, xml = MATCH_XML)
+    reader_for(xml).each_match(path).map { |n| n.read; n.value }
+  end
+
+  def test_each_match_child_steps
+    assert_equal %w[1 2 4], match_values('/feed/items/item/price')
+  end
+
+  def test_each_match_descendant_and_wildcard
+    assert_equal %w[1 2 3 4 5], match_values('//price')
+    assert_equal %w[3], match_values('/feed/items/*/item/price')
+    assert_equal %w[1 2 3 4], match_values('/feed//item/price')
+  end
+
+  def test_each_match_attribute_predicates
+    assert_equal %w[1 3], match_values("//item[@type='x']/price")
+    assert_equal %w[4], match_values('//item[@type="x & z"]/price')
+    assert_equal %w[1 2 3 4], match_values('//item[@type]/price')
+    assert_equal [], match_values('//item[@missing]/price')
+  end
+
+  def test_each_match_yields_elements_and_allows_consuming
+    r = reader_for(MATCH_XML)
+    hashes = r.each_match('/feed/items/item').map { |n| n.read_subtree_hash }
+    assert_equal({ 'type' => 'x', 'price' => '1', 'sku' => 'a' }, hashes.first)
+    assert_equal 3, hashes.size
+  end
+
+  def test_each_match_anchored_at_current_depth
+    r = reader_for(MATCH_XML)
+    r.read; r.read # <items>
+    assert_equal %w[item item group item], r.each_match('/*').map(&:name)
+    assert_equal 'items', r.name
+    r.read
+    assert_equal 'price', r.name
+  end
+
+  def test_each_match_rejects_bad_paths
+    ['', 'feed/item', '/feed/', '/a[@x=1]', '/a[x]', "/a[@x='y"].each do |path|
+      assert_raises(ArgumentError, path) { reader_for('<a/>').each_match(path) {} }
+    end
+  end
+
+  # ── Event handlers ──────────────────────────────────────────────────
+
+  EVENT_XML = '<feed><item id="1"><title>A &amp; B</title></item><skip x="y"/><item id="2"><title><![CDATA[C]]></title></item></feed>'
+
+  def test_run_dispatches_named_handlers
+    seen = []
+    r = FastXmlReader.new(StringIO.new(EVENT_XML), cdata: true)
+    r.on(:start, 'item') { |attrs| seen << [:item, attrs] }
+     .on(:text, 'title') { |text| seen << [:title, text] }
+     .on(:end, 'item') { seen << [:end] }
+    assert_same r, r.run
+    assert_equal [[:item, { 'id' => '1' }], [:title, 'A & B'], [:end],
+                  [:item, { 'id' => '2' }], [:title, 'C'], [:end]], seen
+  end
+
+  def test_run_catch_all_handlers_see_every_node
+    events = []
+    r = reader_for(EVENT_XML)
+    r.on(:start) { |name, attrs| events << [:start, name, attrs.size] }
+    r.on(:text) { |text| events << [:text, text] }
+    r.on(:end) { |name| events << [:end, name] }
+    r.run
+    assert_equal [:start, 'feed', 0], events.first
+    assert_includes events, [:start, 'skip', 1]
+    assert_includes events, [:end, 'skip']
+    assert_equal [:end, 'feed'], events.last
+    assert_equal events.count { |e| e[0] == :start }, events.count { |e| e[0] == :end }
+  end
+
+  def test_run_with_only_start_handlers
+    ids = []
+    r = reader_for(EVENT_XML)
+    r.on(:start, 'item') { |attrs| ids << attrs['id'] }
+    r.on(:start, 'skip') { ids << :skip }
+    r.run
+    assert_equal ['1', :skip, '2'], ids
+    refute r.read
+  end
+
+  def test_run_handlers_may_skip_subtrees
+    names = []
+    r = reader_for(EVENT_XML)
+    r.on(:start, 'item') { r.skip_subtree }
+    r.on(:start) { |name| names << name }
+    r.on(:end) { |name| names << "/#{name}" }
+    r.run
+    assert_equal %w[feed item /item skip /skip item /item /feed], names
+  end
+
+  def test_run_handlers_reading_on_see_all_attributes
+    xml = '<feed><item id="1"><price cur="USD">5</price></item><other a="b"/></feed>'
+    expected = reader_for(xml).each_element('item').map(&:read_subtree_hash)
+    hashes = []
+    r = reader_for(xml)
+    r.on(:start, 'item') { hashes << r.read_subtree_hash }
+    r.run
+    assert_equal expected, hashes
+    assert_equal({ 'id' => '1', 'price' => { 'cur' => 'USD', '__content__' => '5' } }, hashes.first)
+
+    attrs = []
+    r = reader_for(xml)
+    r.on(:start, 'item') { r.read; attrs << r.attributes }
+    r.on(:end) { |name| attrs << [name, r.attributes] if name == 'other' }
+    r.run
+    assert_equal [{ 'cur' => 'USD' }, ['other', { 'a' => 'b' }]], attrs
+  end
+
+  def test_run_lambda_arity_is_respected
+    names = []
+    r = reader_for('<a><b/></a>')
+    r.on(:start, &->(name) { names << name })
+    r.run
+    assert_equal %w[a b], names
+  end
+
+  def test_on_validates_arguments
+    r = reader_for('<a/>')
+    assert_raises(ArgumentError) { r.on(:start) }
+    assert_raises(ArgumentError) { r.on(:comment) {} }
+    r.on(:start) { r.on(:end) {} }
+    assert_raises(RuntimeError) { r.run }
+  end
+
   # ── Node properties ─────────────────────────────────────────────────
 
   def test_name_returns_element_name
@@ -142,6 +370,38 @@ class TestFastXmlReader < Minitest::Test
     assert_nil r.attribute('missing')
   end
 
+  def test_attributes_hash
+    r = reader_for('<item id="42" class="a &amp; b" xmlns="urn:x"/>')
+    r.read
+    attrs = r.attributes
+    assert_equal({ 'id' => '42', 'class' => 'a & b' }, attrs)
+    assert attrs.keys.all?(&:frozen?)
+    assert_equal({}, reader_for('<a>t</a>').tap { |x| x.read; x.read }.attributes)
+  end
+
+  def test_attribute_at_and_count
+    r = reader_for('<item id="42" class="main"/>')
+    r.read
+    assert_equal 2, r.attribute_count
+    assert_equal '42', r.attribute_at(0)
+    assert_equal 'main', r.attribute_at(1)
+    assert_nil r.attribute_at(2)
+    assert_nil r.attribute_at(-1)
+  end
+
+  def test_more_than_32_attributes
+    attrs = (0...150).map { |i| %(a#{i}="v#{i}") }.join(' ')
+    r = reader_for("<row #{attrs}/><row x=\"1\"/><row #{attrs}/>")
+    r.read
+    assert_equal 150, r.attribute_count
+    assert_equal 'v149', r.attribute('a149')
+    assert_equal 'v100', r.attribute_at(100)
+    r.read
+    assert_equal({ 'x' => '1' }, r.attributes)
+    r.read
+    assert_equal 150, r.attributes.size
+  end
+
   def test_empty_element_self_closing
     r = reader_for('<br/>')
     r.read
@@ -162,6 +422,425 @@ class TestFastXmlReader < Minitest::Test
     assert_equal false, r.empty_element?
   end
 
+  def test_cache_stats_counts_hits_and_misses
+    r = reader_for('<a><b/><b/><c/></a>')
+    r.each(&:name)
+    stats = r.cache_stats
+    assert_equal 3, stats[:misses]
+    assert_equal 2, stats[:hits] # second <b/> and </a>
+    assert_equal 0, stats[:overflows]
+    assert_equal 3, stats[:size]
+  end
+
+  def test_stats_disabled_by_default
+    r = reader_for('<a/>')
+    r.read
+    assert_nil r.stats
+  end
+
+  def test_stats_counters
+    attrs = (0...40).map { |i| %(a#{i}="v") }.join(' ')
+    xml = "<a><!-- 0123456789 --><b #{attrs}>x &amp; y</b><c></c><![CDATA[zz]]></a>"
+    stats = with_xml_file(xml) do |path|
+      r = FastXmlReader.new(path, stats: true)
+      r.each { |n| n.value }
+      r.stats.merge(names: r.cache_stats)
+    end
+    assert_equal({ element: 3, text: 1, cdata: 0, end_element: 2 }, stats[:nodes])
+    assert_equal xml.bytesize, stats[:bytes_scanned]
+    assert_equal ' 0123456789 -->'.size + 'zz]]>'.size, stats[:bytes_skipped]
+    assert_equal 1, stats[:entity_decodes]
+    assert_equal 8, stats[:attr_overflows]
+    assert_equal 1, stats[:collapsed_empty]
+    assert_equal stats[:names][:misses], stats[:intern_misses]
+    assert_equal %i[scan attrs decode skip], stats[:cycles].keys
+    assert stats[:cycles].values.all? { |c| c.is_a?(Integer) && c >= 0 }
+  end
+
+  def test_stats_count_skipped_subtrees
+    r = FastXmlReader.new(StringIO.new('<a><b><c/><c/></b><d/></a>'), stats: true)
+    r.read; r.read
+    r.skip_subtree
+    r.read
+    assert_equal 'd', r.name
+    assert_equal '<c/><c/></b>'.size, r.stats[:bytes_skipped]
+    assert_equal 3, r.stats[:nodes][:element]
+  end
+
+  def test_stats_match_between_stream_and_memory
+    xml = '<root>' + ('<r id="1"><v>text &amp; more</v><e></e><!-- c --><?p x?></r>' * 2000) + '</root>'
+    counters = lambda do |r|
+      r.read while r.read
+      r.stats.reject { |k, _| k == :cycles || k == :bytes_rescanned }
+    end
+    memory = with_xml_file(xml) { |path| counters.call(FastXmlReader.new(path, stats: true)) }
+    assert_equal xml.bytesize, memory[:bytes_scanned]
+    [17, 4096].each do |chunk|
+      stream = counters.call(FastXmlReader.new(StringIO.new(xml), chunk_size: chunk, stats: true))
+      assert_equal memory, stream, "chunk_size #{chunk}"
+    end
+  end
+
+  def test_cache_grows_for_many_distinct_names
+    xml = '<root>' + (0...2000).map { |i| "<n#{i}/>" }.join + '</root>'
+    r = reader_for(xml)
+    first = r.each.map(&:name)
+    stats = r.cache_stats
+    assert_equal 0, stats[:overflows]
+    assert_equal 2001, stats[:size]
+    assert_operator stats[:capacity], :>=, 2 * stats[:size]
+
+    r = reader_for(xml + xml)
+    names = r.each.map(&:name)
+    assert_equal first + first, names
+    assert_same names[1], names[first.size + 1]
+  end
+
+  def test_cache_is_empty_until_names_are_used
+    r = reader_for('<a/>')
+    r.read
+    assert_equal 0, r.cache_stats[:capacity]
+  end
+
+  def test_dedup_values_shares_frozen_strings
+    r = FastXmlReader.new(StringIO.new('<a><s c="EUR">true</s><s c="EUR">true</s></a>'), dedup_values: true)
+    values = []
+    attrs = []
+    r.each do |n|
+      values << n.value if n.node_type == FastXmlReader::TYPE_TEXT
+      attrs << n.attribute('c') if n.node_type == FastXmlReader::TYPE_ELEMENT && n.name == 's'
+    end
+    assert_equal %w[true true], values
+    assert_same values[0], values[1]
+    assert_same attrs[0], attrs[1]
+    assert values[0].frozen?
+    assert_equal 2, r.value_cache_stats[:size]
+    assert_equal 2, r.value_cache_stats[:hits]
+  end
+
+  def test_dedup_values_skips_long_values
+    long = 'x' * 100
+    r = FastXmlReader.new(StringIO.new("<a>#{long}</a>"), dedup_values: true)
+    r.read; r.read
+    assert_equal long, r.value
+    refute r.value.frozen?
+  end
+
+  def test_dedup_values_decoded_and_subtree
+    r = FastXmlReader.new(StringIO.new('<a><b>x &amp; y</b><c>k<d/>k</c></a>'), dedup_values: true)
+    r.read
+    assert_equal({ 'b' => 'x & y', 'c' => { 'd' => nil, '__content__' => 'kk' } }, r.read_subtree_hash)
+  end
+
+  def test_values_not_deduplicated_by_default
+    r = reader_for('<a>v</a>')
+    r.read; r.read
+    refute_same r.value, r.value
+    refute r.value.frozen?
+  end
+
+  def test_value_eq
+    r = reader_for('<a>hello</a>')
+    r.read
+    refute r.value_eq?('hello')
+    r.read
+    assert r.value_eq?('hello')
+    refute r.value_eq?('hell')
+    refute r.value_eq?('hello!')
+  end
+
+  def test_value_eq_decodes_entities
+    r = reader_for('<a>a &amp; b &#x41;&bogus;&</a>')
+    r.read; r.read
+    assert r.value_eq?(r.value)
+    refute r.value_eq?('a &amp; b A&bogus;&')
+    refute r.value_eq?('a & b A&bogus;')
+  end
+
+  def test_attribute_eq
+    r = reader_for('<a id="7" q="x &lt; y"/>')
+    r.read
+    assert r.attribute_eq?('id', '7')
+    refute r.attribute_eq?('id', '70')
+    assert r.attribute_eq?('q', 'x < y')
+    refute r.attribute_eq?('missing', '')
+  end
+
+  def test_value_as_integer
+    r = reader_for("<a><b>\n  42\n</b><c>-7</c><d>123456789012345678901234</d><e/></a>")
+    r.read; r.read; r.read
+    assert_equal 42, r.value_as_integer
+    r.read; r.read; r.read
+    assert_equal(-7, r.value_as_integer)
+    r.read; r.read; r.read
+    assert_equal 123_456_789_012_345_678_901_234, r.value_as_integer
+    r.read; r.read
+    assert_nil r.value_as_integer
+  end
+
+  def test_value_as_integer_rejects_garbage
+    r = reader_for('<a>12abc</a>')
+    r.read; r.read
+    assert_raises(ArgumentError) { r.value_as_integer }
+  end
+
+  def test_value_as_float_and_boolean
+    r = reader_for('<a><p> 19.99 </p><f>1e3</f><t>true</t><z>0</z></a>')
+    r.read; r.read; r.read
+    assert_in_delta 19.99, r.value_as_float
+    r.read; r.read; r.read
+    assert_equal 1000.0, r.value_as_float
+    r.read; r.read; r.read
+    assert_equal true, r.value_as_boolean
+    r.read; r.read; r.read
+    assert_equal false, r.value_as_boolean
+
+    b = reader_for('<a>yes</a>')
+    b.read; b.read
+    assert_raises(ArgumentError) { b.value_as_boolean }
+  end
+
+  def test_value_as_time
+    r = reader_for('<a><u>2024-03-01T12:34:56.25Z</u><o>2024-03-01T12:34:56+05:30</o></a>')
+    r.read; r.read; r.read
+    t = r.value_as_time
+    assert t.utc?
+    assert_equal Time.utc(2024, 3, 1, 12, 34, 56.25), t
+    r.read; r.read; r.read
+    t = r.value_as_time
+    assert_equal 19_800, t.utc_offset
+    assert_equal Time.utc(2024, 3, 1, 7, 4, 56), t
+  end
+
+  def test_value_as_time_local_and_invalid
+    r = reader_for('<a><l>2024-03-01T08:00:00</l><x>2024-13-01</x></a>')
+    r.read; r.read; r.read
+    assert_equal Time.local(2024, 3, 1, 8), r.value_as_time
+    r.read; r.read; r.read
+    assert_raises(ArgumentError) { r.value_as_time }
+  end
+
+  def test_attribute_as_integer_and_float
+    r = reader_for('<a id="12" price="3.5" n="&#49;0"/>')
+    r.read
+    assert_equal 12, r.attribute_as_integer('id')
+    assert_equal 10, r.attribute_as_integer('n')
+    assert_equal 3.5, r.attribute_as_float('price')
+    assert_nil r.attribute_as_integer('missing')
+  end
+
+  def test_text_keeps_surrounding_whitespace_by_default
+    r = reader_for("<a>\n  hello world\n</a>")
+    r.read; r.read
+    assert_equal "\n  hello world\n", r.value
+  end
+
+  def test_strip_text
+    r = FastXmlReader.new(StringIO.new("<a>\n  hello &amp; bye\t</a>"), strip_text: true)
+    r.read; r.read
+    assert_equal 'hello & bye', r.value
+    assert r.value_eq?('hello & bye')
+  end
+
+  def test_keep_blanks
+    xml = "<a>\n  <b>x</b> <c/>\n</a>"
+    types = FastXmlReader.new(StringIO.new(xml), keep_blanks: true).each.map(&:node_type)
+    t = FastXmlReader::TYPE_TEXT
+    assert_equal [1, t, 1, t, 15, t, 1, t, 15], types
+
+    # Blank nodes are reported as-is even with strip_text
+    r = FastXmlReader.new(StringIO.new(xml), keep_blanks: true, strip_text: true)
+    r.read; r.read
+    assert_equal "\n  ", r.value
+  end
+
+  # ── Subtree materialization ─────────────────────────────────────────
+
+  def test_read_subtree_hash
+    r = reader_for('<feed><product id="7"><name>Widget &amp; Co</name><tag>a</tag><tag>b</tag>' \
+                   '<price currency="EUR">9.99</price><note/></product><next/></feed>')
+    r.read # <feed>
+    r.read # <product>
+    h = r.read_subtree_hash
+    expected = {
+      'id' => '7',
+      'name' => 'Widget & Co',
+      'tag' => %w[a b],
+      'price' => { 'currency' => 'EUR', '__content__' => '9.99' },
+      'note' => nil
+    }
+    assert_equal expected, h
+    assert_equal FastXmlReader::TYPE_END_ELEMENT, r.node_type
+    assert_equal 'product', r.name
+    r.read
+    assert_equal 'next', r.name
+  end
+
+  def test_read_subtree_hash_keys_are_interned
+    r = reader_for('<list><item><v>1</v></item><item><v>2</v></item></list>')
+    r.read
+    h = r.read_subtree_hash
+    assert_equal [{ 'v' => '1' }, { 'v' => '2' }], h['item']
+    assert h.keys.first.frozen?
+    assert_same h['item'][0].keys.first, h['item'][1].keys.first
+  end
+
+  def test_read_subtree_hash_text_and_empty
+    r = reader_for('<a>hello <b/>world</a>')
+    r.read
+    assert_equal({ 'b' => nil, '__content__' => 'hello world' }, r.read_subtree_hash)
+
+    r = reader_for('<a x="1"/>')
+    r.read
+    assert_equal({ 'x' => '1' }, r.read_subtree_hash)
+  end
+
+  def test_read_subtree_hash_nil_off_element
+    r = reader_for('<a>text</a>')
+    r.read; r.read
+    assert_nil r.read_subtree_hash
+  end
+
+  # ── Subtree skipping ────────────────────────────────────────────────
+
+  SKIP_XML = '<root><images a="x>y" b=\'"\'><img src="1"/><images><img/></images>' \
+             '<!-- </images> --><![CDATA[</images>]]><?pi </images> ?>text</images>' \
+             '<name>kept</name></root>'
+
+  def test_skip_subtree_stops_on_matching_end_tag
+    r = reader_for(SKIP_XML)
+    r.read # <root>
+    r.read # <images>
+    assert_equal true, r.skip_subtree
+    assert_equal FastXmlReader::TYPE_END_ELEMENT, r.node_type
+    assert_equal 'images', r.name
+    assert_equal 1, r.depth
+    r.read
+    assert_equal 'name', r.name
+    assert_equal 1, r.depth
+  end
+
+  def test_next_sibling
+    r = reader_for(SKIP_XML)
+    r.read # <root>
+    r.read # <images>
+    assert_equal true, r.next_sibling
+    assert_equal 'name', r.name
+    assert_equal FastXmlReader::TYPE_ELEMENT, r.node_type
+  end
+
+  def test_skip_subtree_on_empty_element_is_noop
+    r = reader_for('<a><b/><c/></a>')
+    r.read; r.read
+    assert_equal true, r.skip_subtree
+    assert_equal 'b', r.name
+    r.read
+    assert_equal 'c', r.name
+  end
+
+  def test_skip_subtree_truncated_document
+    r = reader_for('<a><b><c>')
+    r.read
+    assert_equal false, r.skip_subtree
+    assert_equal false, r.read
+  end
+
+  def test_skip_subtree_streaming_any_chunk_size
+    (1..12).each do |size|
+      r = FastXmlReader.new(StringIO.new(SKIP_XML), chunk_size: size)
+      r.read; r.read
+      assert_equal 'name', (r.next_sibling && r.name), "chunk_size: #{size}"
+      r.read
+      assert_equal 'kept', r.value
+    end
+  end
+
+  def test_skip_large_subtree
+    xml = '<root><big>' + ('<row id="1"><v>x</v></row>' * 50_000) + '</big><after/></root>'
+    with_xml_file(xml) do |path|
+      r = FastXmlReader.new(path)
+      r.read; r.read
+      assert_equal true, r.next_sibling
+      assert_equal 'after', r.name
+      assert_equal 1, r.depth
+    end
+  end
+
+  SKIP_IMAGES = SKIP_XML[/<images a=.*text<\/images>/]
+
+  def test_outer_xml_slice_returns_raw_bytes
+    with_xml_file(SKIP_XML) do |path|
+      r = FastXmlReader.new(path)
+      assert_nil r.outer_xml_slice # before the first node
+      r.read # <root>
+      r.read # <images>
+      assert_equal SKIP_IMAGES, r.outer_xml_slice
+      assert_equal FastXmlReader::TYPE_END_ELEMENT, r.node_type
+      r.read
+      assert_equal 'name', r.name
+      assert_equal '<name>kept</name>', r.outer_xml_slice
+    end
+  end
+
+  def test_outer_xml_slice_of_empty_element_and_stream_chunks
+    r = reader_for('<a><b x="1"/></a>')
+    r.read
+    r.read
+    assert_equal '<b x="1"/>', r.outer_xml_slice
+    [1, 7, 64].each do |size|
+      r = FastXmlReader.new(StringIO.new(SKIP_XML), chunk_size: size)
+      r.read
+      r.read
+      assert_equal SKIP_IMAGES, r.outer_xml_slice, "chunk_size: #{size}"
+      r.read
+      assert_equal 'name', r.name
+    end
+  end
+
+  def test_write_subtree_to_file_and_stringio
+    out = Tempfile.new('subtree')
+    out.write('>>')
+    r = reader_for(SKIP_XML)
+    r.read
+    r.read
+    assert_equal SKIP_IMAGES.bytesize, r.write_subtree(out)
+    r.read
+    sio = StringIO.new
+    assert_equal 17, r.write_subtree(sio)
+    assert_equal '<name>kept</name>', sio.string
+    out.close
+    assert_equal ">>#{SKIP_IMAGES}", File.read(out.path)
+    r.read
+    assert_nil r.write_subtree(sio)
+  ensure
+    out.close! if out
+  end
+
+  def test_write_subtree_large_element_to_pipe
+    big = "<big>#{'<i>x</i>' * 5000}</big>"
+    r = reader_for("<r>#{big}<after/></r>")
+    r.read
+    r.read
+    rd, wr = IO.pipe
+    reader = Thread.new { rd.read }
+    wr.write('<')
+    assert_equal big.bytesize, r.write_subtree(wr)
+    wr.close
+    assert_equal "<#{big}", reader.value
+    r.read
+    assert_equal 'after', r.name
+  ensure
+    rd.close if rd
+  end
+
+  def test_outer_xml_slice_keeps_source_encoding
+    r = reader_for(LATIN1_XML)
+    r.read
+    slice = r.outer_xml_slice
+    assert_equal Encoding::ISO_8859_1, slice.encoding
+    assert_equal LATIN1_XML[/<caf.*/], slice.b
+  end
+
   # ── Entity decoding ─────────────────────────────────────────────────
 
   def test_named_entity_amp
@@ -212,12 +891,66 @@ class TestFastXmlReader < Minitest::Test
     assert_equal '&unknown;', r.value
   end
 
+  def test_malformed_character_references_passed_through
+    r = reader_for('<a>&#;&#x;&#12a;&#xZZ;&#1114112;&#x10FFFF;</a>')
+    r.read; r.read
+    assert_equal "&#;&#x;&#12a;&#xZZ;&#1114112;\u{10FFFF}", r.value
+  end
+
+  def test_stray_ampersands_in_long_value
+    body = ('a & b ' * 2000) + '&amp;'
+    r = reader_for("<a>#{body}</a>")
+    r.read; r.read
+    assert_equal ('a & b ' * 2000) + '&', r.value
+  end
+
+  def test_decoding_reuses_scratch_between_values
+    r = reader_for('<a x="1 &lt; 2"><b>long &amp; ' + 'x' * 1000 + '</b><c>&gt;</c></a>')
+    r.read
+    assert_equal '1 < 2', r.attribute('x')
+    r.read; r.read
+    assert_equal 'long & ' + 'x' * 1000, r.value
+    r.read; r.read; r.read
+    assert_equal '>', r.value
+  end
+
   def test_text_without_entities_no_decode
     r = reader_for('<a>plain text</a>')
     r.read; r.read
     assert_equal 'plain text', r.value
   end
 
+  # ── Structural scanning ─────────────────────────────────────────────
+
+  def test_long_element_and_attribute_names
+    [1, 15, 16, 17, 31, 32, 33, 70].each do |len|
+      name = 'n' * len
+      r = reader_for("<#{name} #{name}=\"v\"><#{name}/></#{name}>")
+      r.read
+      assert_equal name, r.name
+      assert_equal 'v', r.attribute(name)
+      r.read
+      assert_equal true, r.empty_element?
+    end
+  end
+
+  def test_long_whitespace_runs_between_attributes
+    [1, 15, 16, 17, 40, 100].each do |len|
+      ws = " \t\r\n" * len
+      r = reader_for("<a#{ws}x#{ws}=#{ws}'1'#{ws}y='2'#{ws}/>")
+      r.read
+      assert_equal 'a', r.name
+      assert_equal '1', r.attribute('x')
+      assert_equal '2', r.attribute('y')
+      assert_equal true, r.empty_element?
+    end
+  end
+
+  def test_long_blank_text_is_skipped
+    text_nodes = collect_nodes("<a>#{' ' * 100}</a><b>#{' ' * 100}x</b>").select { |n| n[:type] == FastXmlReader::TYPE_TEXT }
+    assert_equal ["#{' ' * 100}x"], text_nodes.map { |n| n[:value] }
+  end
+
   # ── Namespace handling ──────────────────────────────────────────────
 
   def test_namespace_prefix_stripped_from_element
@@ -249,6 +982,51 @@ class TestFastXmlReader < Minitest::Test
     assert_equal '1', r.attribute('id')
   end
 
+  NS_XML = '<feed xmlns="urn:atom" xmlns:a="urn:a">' \
+           '<a:id>1</a:id>' \
+           '<entry xmlns:a="urn:other"><a:id xml:lang="en">2</a:id><id xmlns="">3</id></entry>' \
+           '<a:id/>' \
+           '</feed>'
+
+  def test_prefix_and_local_name
+    r = reader_for('<x:item><plain/></x:item>')
+    r.read
+    assert_equal 'x', r.prefix
+    assert_equal 'item', r.local_name
+    r.read
+    assert_nil r.prefix
+    r.read
+    assert_equal 'x', r.prefix
+  end
+
+  def test_namespace_uri_resolution
+    r = FastXmlReader.new(StringIO.new(NS_XML), namespaces: true)
+    seen = []
+    r.each { |n| seen << [n.name, n.namespace_uri] if n.node_type == FastXmlReader::TYPE_ELEMENT }
+    assert_equal [%w[feed urn:atom], %w[id urn:a], %w[entry urn:atom], %w[id urn:other],
+                  ['id', nil], %w[id urn:a]], seen
+  end
+
+  def test_expanded_name_disambiguates_prefixes
+    r = FastXmlReader.new(StringIO.new(NS_XML), namespaces: true, chunk_size: 5)
+    names = []
+    r.each { |n| names << n.expanded_name if n.name == 'id' }
+    assert_equal ['{urn:a}id', '{urn:a}id', '{urn:other}id', '{urn:other}id', 'id', 'id', '{urn:a}id'], names
+    assert names.all?(&:frozen?)
+  end
+
+  def test_namespace_uri_on_end_element_and_off_by_default
+    r = FastXmlReader.new(StringIO.new('<p:a xmlns:p="urn:p"><b/></p:a>'), namespaces: true)
+    r.read; r.read; r.read
+    assert_equal FastXmlReader::TYPE_END_ELEMENT, r.node_type
+    assert_equal 'urn:p', r.namespace_uri
+
+    r = reader_for('<p:a xmlns:p="urn:p"/>')
+    r.read
+    assert_nil r.namespace_uri
+    assert_nil r.attribute('xmlns:p')
+  end
+
   # ── Skipped content ─────────────────────────────────────────────────
 
   def test_comments_skipped
@@ -273,6 +1051,29 @@ class TestFastXmlReader < Minitest::Test
     assert_equal ['text'], text_values
   end
 
+  def test_cdata_option_emits_cdata_nodes
+    r = FastXmlReader.new(StringIO.new('<a><![CDATA[x &amp; <y>]]>text</a>'), cdata: true)
+    nodes = nodes_from(r)
+    assert_equal({ name: nil, type: FastXmlReader::TYPE_CDATA, depth: 1, value: 'x &amp; <y>' }, nodes[1])
+    assert_equal 'text', nodes[2][:value]
+  end
+
+  def test_empty_cdata_value_is_empty_string
+    r = FastXmlReader.new(StringIO.new('<a><![CDATA[]]></a>'), cdata: true)
+    r.read
+    r.read
+    assert_equal FastXmlReader::TYPE_CDATA, r.node_type
+    assert_equal '', r.value
+    assert r.value_eq?('')
+  end
+
+  def test_cdata_option_in_subtree_hash_and_stream
+    xml = '<a><d><![CDATA[<b>bold</b>]]> tail</d></a>'
+    r = FastXmlReader.new(StringIO.new(xml), cdata: true, chunk_size: 3)
+    r.read
+    assert_equal({ 'd' => '<b>bold</b> tail' }, r.read_subtree_hash)
+  end
+
   def test_doctype_skipped
     nodes = collect_nodes('<!DOCTYPE html><root>hello</root>')
     names = nodes.map { |n| n[:name] }.compact
@@ -285,6 +1086,647 @@ class TestFastXmlReader < Minitest::Test
     refute_includes types, FastXmlReader::TYPE_TEXT
   end
 
+  # ── Streaming IO ────────────────────────────────────────────────────
+
+  STREAM_XML = '<?xml version="1.0"?>' \
+               '<!DOCTYPE feed>' \
+               "<feed xmlns:x=\"urn:x\">\n" \
+               "  <!-- a comment -- with dashes -->\n" \
+               "  <x:item id=\"1\" note='a &amp; b'>one &lt; two</x:item>\n" \
+               "  <item id=\"2\"></item>\n" \
+               "  <![CDATA[ignored ]] data]]>\n" \
+               "  <empty/>\n" \
+               "  <text>  spaced   words  </text>\n" \
+               "</feed>\n"
+
+  def nodes_from(reader)
+    nodes = []
+    reader.each { |n| nodes << { name: n.name, type: n.node_type, depth: n.depth, value: n.value } }
+    nodes
+  end
+
+  class CountingIO
+    attr_reader :reads
+
+    def initialize(str)
+      @io = StringIO.new(str)
+      @reads = 0
+    end
+
+    def read(len)
+      @reads += 1
+      @io.read(len)
+    end
+  end
+
+  def test_streaming_matches_whole_document_for_any_chunk_size
+    file = Tempfile.new(['stream', '.xml'])
+    file.write(STREAM_XML)
+    file.close
+    expected = nodes_from(FastXmlReader.new(file.path))
+    (1..24).each do |size|
+      nodes = nodes_from(FastXmlReader.new(StringIO.new(STREAM_XML), chunk_size: size))
+      assert_equal expected, nodes, "chunk_size: #{size}"
+    end
+  ensure
+    file.unlink if file
+  end
+
+  def test_streaming_attributes_across_chunks
+    r = FastXmlReader.new(StringIO.new('<a first="1" second="two &amp; three"/>'), chunk_size: 3)
+    r.read
+    assert_equal '1', r.attribute('first')
+    assert_equal 'two & three', r.attribute('second')
+  end
+
+  def test_streaming_reads_on_demand
+    xml = '<root>' + ('<item>x</item>' * 1000) + '</root>'
+    io = CountingIO.new(xml)
+    r = FastXmlReader.new(io, chunk_size: 64)
+    assert_equal 0, io.reads
+    r.read
+    assert_equal 1, io.reads
+    r.each { }
+    assert_operator io.reads, :>, xml.bytesize / 64
+  end
+
+  def test_streaming_empty_io
+    r = reader_for('')
+    assert_equal false, r.read
+  end
+
+  def with_pipe(xml)
+    rd, wr = IO.pipe
+    writer = Thread.new do
+      begin
+        xml.each_char.each_slice(977) { |s| wr.write(s.join) }
+      rescue IOError, Errno::EPIPE
+        nil
+      end
+      wr.close unless wr.closed?
+    end
+    yield rd
+  ensure
+    rd.close unless rd.closed?
+    writer.join
+  end
+
+  def test_pipe_streams_natively_with_and_without_prefetch
+    expected = nodes_from(FastXmlReader.new(StringIO.new(STREAM_XML)))
+    [false, true].each do |prefetch|
+      [5, 4096].each do |size|
+        with_pipe(STREAM_XML) do |io|
+          nodes = nodes_from(FastXmlReader.new(io, chunk_size: size, prefetch: prefetch))
+          assert_equal expected, nodes, "prefetch: #{prefetch}, chunk_size: #{size}"
+        end
+      end
+    end
+  end
+
+  def test_pipe_with_ruby_buffered_bytes_keeps_them
+    with_pipe('x<a>1</a>') do |io|
+      assert_equal 'x', io.getc
+      r = FastXmlReader.new(io, prefetch: true)
+      r.read
+      assert_equal 'a', r.name
+    end
+  end
+
+  def test_prefetch_close_does_not_wait_for_writer
+    rd, wr = IO.pipe
+    wr.write('<a><b/>')
+    r = FastXmlReader.new(rd, chunk_size: 4, prefetch: true)
+    r.read
+    assert_equal 'a', r.name
+    r.close
+  ensure
+    wr.close
+    rd.close
+  end
+
+  def test_chunk_size_must_be_positive
+    assert_raises(ArgumentError) { FastXmlReader.new(StringIO.new('<a/>'), chunk_size: 0) }
+  end
+
+  def test_unknown_option_raises
+    assert_raises(ArgumentError) { FastXmlReader.new(StringIO.new('<a/>'), bogus: 1) }
+  end
+
+  HUGE_NODE_XML = "<r><t>#{'x' * (4 * 1024 * 1024)}</t></r>"
+
+  def test_prefetch_huge_node_is_rescanned_boundedly
+    with_pipe(HUGE_NODE_XML) do |rd|
+      r = FastXmlReader.new(rd, chunk_size: 16 * 1024, prefetch: true, stats: true)
+      r.read; r.read; r.read
+      assert_equal 4 * 1024 * 1024, r.value.bytesize
+      r.each { }
+      assert_equal HUGE_NODE_XML.bytesize, r.stats[:bytes_scanned]
+      assert_operator r.stats[:bytes_rescanned], :<, 3 * HUGE_NODE_XML.bytesize
+    end
+  end
+
+  # ── Compressed input ────────────────────────────────────────────────
+
+  COMPRESSED_XML = '<feed>' + (1..3000).map { |i| %(<item id="#{i}">v &amp; #{i}</item>) }.join + '</feed>'
+
+  def with_compressed_file(bytes, ext)
+    file = Tempfile.new(['feed', ext])
+    file.binmode
+    file.write(bytes)
+    file.close
+    yield file.path
+  ensure
+    file.unlink if file
+  end
+
+  def gzip(str)
+    io = StringIO.new(''.b)
+    gz = Zlib::GzipWriter.new(io)
+    gz.write(str)
+    gz.close
+    io.string
+  end
+
+  def test_gzip_file_matches_plain_document
+    skip 'built without zlib' unless FastXmlReader::COMPRESSION_FORMATS.include?('gzip')
+    expected = nodes_from(reader_for(COMPRESSED_XML))
+    ['<r><a x="1">t</a></r>', COMPRESSED_XML].each do |xml|
+      with_compressed_file(gzip(xml), '.xml.gz') do |path|
+        assert_equal nodes_from(reader_for(xml)), nodes_from(FastXmlReader.new(path, chunk_size: 100))
+      end
+    end
+    with_compressed_file(gzip(COMPRESSED_XML), '.xml.gz') do |path|
+      assert_equal expected, nodes_from(FastXmlReader.new(path, prefetch: true))
+      File.open(path) { |f| assert_equal 3000, FastXmlReader.new(f).count_elements('item') }
+    end
+  end
+
+  def test_gzip_concatenated_members
+    skip 'built without zlib' unless FastXmlReader::COMPRESSION_FORMATS.include?('gzip')
+    with_compressed_file(gzip('<r><a/>') + gzip('<b/></r>'), '.gz') do |path|
+      assert_equal %w[r a b r], FastXmlReader.new(path).each.map(&:name)
+    end
+  end
+
+  def test_truncated_gzip_raises
+    skip 'built without zlib' unless FastXmlReader::COMPRESSION_FORMATS.include?('gzip')
+    data = gzip(COMPRESSED_XML)
+    with_compressed_file(data[0, data.bytesize / 2], '.gz') do |path|
+      [false, true].each do |prefetch|
+        assert_raises(IOError) { FastXmlReader.new(path, prefetch: prefetch).each {} }
+      end
+    end
+  end
+
+  def test_compressed_input_is_a_stream
+    skip 'built without zlib' unless FastXmlReader::COMPRESSION_FORMATS.include?('gzip')
+    with_compressed_file(gzip(COMPRESSED_XML), '.gz') do |path|
+      assert_raises(ArgumentError) { FastXmlReader.new(path, offset: 0, length: 10) }
+      assert_raises(IOError) { FastXmlReader.new(path).seek_to(0) }
+    end
+  end
+
+  def test_zstd_file_matches_plain_document
+    skip 'built without libzstd' unless FastXmlReader::COMPRESSION_FORMATS.include?('zstd')
+    data = IO.popen(%w[zstd -q -c], 'r+b') { |io| io.write(COMPRESSED_XML); io.close_write; io.read } rescue nil
+    skip 'zstd command not available' unless data && !data.empty?
+    expected = nodes_from(reader_for(COMPRESSED_XML))
+    with_compressed_file(data, '.xml.zst') do |path|
+      assert_equal expected, nodes_from(FastXmlReader.new(path, chunk_size: 100))
+      assert_equal expected, nodes_from(FastXmlReader.new(path, prefetch: true))
+    end
+    with_compressed_file(data[0, data.bytesize - 5], '.zst') do |path|
+      assert_raises(IOError) { FastXmlReader.new(path).each {} }
+    end
+  end
+
+  def test_prefetch_huge_compressed_node_is_rescanned_boundedly
+    skip 'built without zlib' unless FastXmlReader::COMPRESSION_FORMATS.include?('gzip')
+    with_compressed_file(gzip(HUGE_NODE_XML), '.xml.gz') do |path|
+      r = FastXmlReader.new(path, chunk_size: 16 * 1024, prefetch: true, stats: true)
+      r.each { }
+      assert_equal HUGE_NODE_XML.bytesize, r.stats[:bytes_scanned]
+      assert_operator r.stats[:bytes_rescanned], :<, 3 * HUGE_NODE_XML.bytesize
+    end
+  end
+
+  # ── Encodings ───────────────────────────────────────────────────────
+
+  LATIN1_XML = %(<?xml version="1.0" encoding="ISO-8859-1"?><caf\xE9 nom="Andr\xE9">cr\xE8me &amp; br\xFBl\xE9e</caf\xE9>).b
+
+  def test_declared_single_byte_encoding_is_transcoded
+    with_xml_file(LATIN1_XML) do |path|
+      r = FastXmlReader.new(path)
+      assert_equal Encoding::ISO_8859_1, r.encoding
+      r.read
+      assert_equal 'café', r.name
+      assert_equal Encoding::UTF_8, r.name.encoding
+      assert_equal 'André', r.attribute('nom')
+      assert_equal({ 'nom' => 'André' }, r.attributes)
+      r.read
+      assert_equal 'crème & brûlée', r.value
+      assert r.value_eq?('crème & brûlée')
+    end
+  end
+
+  def test_windows_1252_stream_across_chunks
+    xml = %(<?xml version='1.0' encoding='windows-1252'?><p a="\x93q\x94">5 \x80</p>).b
+    r = FastXmlReader.new(StringIO.new(xml), chunk_size: 4, dedup_values: true)
+    r.read
+    assert_equal Encoding::Windows_1252, r.encoding
+    assert_equal '“q”', r.attribute('a')
+    assert r.attribute_eq?('a', '“q”')
+    r.read
+    assert_equal '5 €', r.value
+    assert r.value.valid_encoding?
+  end
+
+  def test_multibyte_encoding_tags_strings
+    xml = '<?xml version="1.0" encoding="Shift_JIS"?><a>日本</a>'.encode('Shift_JIS').b
+    r = reader_for(xml)
+    r.read
+    r.read
+    assert_equal Encoding::Shift_JIS, r.value.encoding
+    assert_equal '日本', r.value.encode('UTF-8')
+  end
+
+  def test_reset_rebuilds_table_for_new_encoding
+    r = reader_for(%(<?xml version="1.0" encoding="Windows-1252"?><a>\x80</a>).b)
+    r.read; r.read
+    assert_equal '€', r.value
+    r.reset(StringIO.new(%(<?xml version="1.0" encoding="ISO-8859-15"?><a>\xA4</a>).b))
+    r.read; r.read
+    assert_equal '€', r.value
+    r.reset(StringIO.new(%(<?xml version="1.0" encoding="ISO-8859-1"?><a>\xA4</a>).b))
+    r.read; r.read
+    assert_equal '¤', r.value
+  end
+
+  def test_single_byte_input_in_ractors
+    skip 'Ractor not available' unless defined?(Ractor)
+    verbose, $VERBOSE = $VERBOSE, nil
+    ractors = %w[ISO-8859-1 Windows-1252 ISO-8859-15].map do |enc|
+      Ractor.new(enc) do |e|
+        xml = %(<?xml version="1.0" encoding="#{e}"?><a>\xE9</a>).b
+        r = FastXmlReader.new(StringIO.new(xml))
+        r.read; r.read
+        r.value
+      end
+    end
+    values = ractors.map { |rc| rc.respond_to?(:value) ? rc.value : rc.take }
+    $VERBOSE = verbose
+    assert_equal %w[é é é], values
+  end
+
+  def test_utf8_bom_is_skipped
+    r = reader_for("\xEF\xBB\xBF<a>t</a>".b)
+    r.read
+    assert_equal 'a', r.name
+    assert_equal 0, r.depth
+    assert_equal Encoding::UTF_8, r.encoding
+  end
+
+  def test_utf8_bom_is_skipped_with_tiny_chunks
+    expected = nodes_from(reader_for("<a>x</a>"))
+    [1, 2, 3, 4].each do |chunk|
+      r = FastXmlReader.new(StringIO.new("\xEF\xBB\xBF<a>x</a>".b), chunk_size: chunk)
+      assert_equal expected, nodes_from(r), "chunk_size #{chunk}"
+    end
+    r = FastXmlReader.new(StringIO.new("<?xml version='1.0' encoding='ISO-8859-1'?><a>\xE9</a>".b), chunk_size: 1)
+    r.read
+    r.read
+    assert_equal 'é', r.value
+  end
+
+  def test_encoding_option_overrides_declaration
+    r = FastXmlReader.new(StringIO.new("<a>\xE9</a>".b), encoding: 'ISO-8859-1')
+    r.read
+    r.read
+    assert_equal 'é', r.value
+    assert_raises(ArgumentError) { FastXmlReader.new(StringIO.new('<a/>'), encoding: 'UTF-16LE') }
+  end
+
+  def test_utf16_input_raises
+    assert_raises(ArgumentError) { reader_for("\xFF\xFE<\x00a\x00/\x00>\x00".b).read }
+  end
+
+  def test_undeclared_input_stays_utf8
+    r = reader_for('<?xml version="1.0"?><a>é</a>')
+    r.read
+    r.read
+    assert_equal Encoding::UTF_8, r.encoding
+    assert_equal 'é', r.value
+  end
+
+  # ── Partitioning ────────────────────────────────────────────────────
+
+  def with_records_file(count)
+    file = Tempfile.new(['records', '.xml'])
+    file.write(%(<?xml version="1.0"?>\n<feed>\n))
+    count.times { |i| file.write(%(  <record id="#{i}"><name>n#{i}</name></record>\n)) }
+    file.write("</feed>\n")
+    file.close
+    yield file.path
+  ensure
+    file.unlink if file
+  end
+
+  def record_ids(path, offset, length)
+    r = FastXmlReader.new(path, offset: offset, length: length)
+    r.each_element('record').map { |n| n.attribute('id') }
+  ensure
+    r.close if r
+  end
+
+  def test_split_records_covers_every_record_once
+    with_records_file(500) do |path|
+      ranges = FastXmlReader.new(path).split_records('record', 4)
+      assert_equal 4, ranges.size
+      ids = ranges.flat_map { |off, len| record_ids(path, off, len) }
+      assert_equal (0...500).map(&:to_s), ids
+      ranges.each_cons(2) { |(o1, l1), (o2, _)| assert_equal o1 + l1, o2 }
+    end
+  end
+
+  def test_split_records_ranges_start_at_record_tags
+    with_records_file(50) do |path|
+      data = File.binread(path)
+      FastXmlReader.new(path).split_records('record', 3).each do |off, len|
+        assert data[off, len].start_with?('<record ')
+        assert data[off, len].rstrip.end_with?('</record>')
+      end
+    end
+  end
+
+  def test_split_records_more_parts_than_records
+    with_records_file(2) do |path|
+      ranges = FastXmlReader.new(path).split_records('record', 10)
+      assert_equal %w[0 1], ranges.flat_map { |off, len| record_ids(path, off, len) }
+    end
+  end
+
+  def test_split_records_requires_mmap
+    assert_raises(IOError) { reader_for('<a/>').split_records('a', 2) }
+  end
+
+  def test_offset_requires_mmappable_input
+    assert_raises(ArgumentError) { FastXmlReader.new(StringIO.new('<a/>'), offset: 1) }
+  end
+
+  def test_split_records_in_ractors
+    skip 'Ractor not available' unless defined?(Ractor)
+    with_records_file(200) do |path|
+      ranges = FastXmlReader.new(path).split_records('record', 4)
+      verbose, $VERBOSE = $VERBOSE, nil
+      ractors = ranges.map do |off, len|
+        Ractor.new(path, off, len) do |p, o, l|
+          FastXmlReader.new(p, offset: o, length: l).each_element('record').map { |n| n.attribute('id') }
+        end
+      end
+      ids = ractors.flat_map { |rc| rc.respond_to?(:value) ? rc.value : rc.take }
+      $VERBOSE = verbose
+      assert_equal (0...200).map(&:to_s), ids
+    end
+  end
+
+  # ── Random access ───────────────────────────────────────────────────
+
+  def test_byte_offset_and_seek_to
+    with_records_file(20) do |path|
+      r = FastXmlReader.new(path)
+      r.each_element('record') { |n| break if n.attribute('id') == '7' }
+      offset = r.byte_offset
+      depth = r.depth
+      assert_equal '<record id="7">', File.binread(path)[offset, 15]
+
+      other = FastXmlReader.new(path)
+      other.seek_to(offset, depth)
+      assert_equal true, other.read
+      assert_equal 'record', other.name
+      assert_equal 1, other.depth
+      assert_equal({ 'id' => '7', 'name' => 'n7' }, other.read_subtree_hash)
+    end
+  end
+
+  def test_seek_to_with_ranged_reader
+    with_records_file(20) do |path|
+      off, len = FastXmlReader.new(path).split_records('record', 2).last
+      r = FastXmlReader.new(path, offset: off, length: len)
+      r.read
+      assert_equal off, r.byte_offset
+      r.read; r.read
+      r.seek_to(off)
+      r.read
+      assert_equal off, r.byte_offset
+      assert_raises(ArgumentError) { r.seek_to(off - 1) }
+    end
+  end
+
+  def test_seek_to_drops_namespace_bindings
+    xml = '<root><s xmlns:p="urn:scoped"><p:a/></s><t><p:b/></t></root>'
+    with_xml_file(xml) do |path|
+      r = FastXmlReader.new(path, namespaces: true)
+      r.read; r.read; r.read # <p:a>
+      assert_equal 'urn:scoped', r.namespace_uri
+      r.seek_to(xml.index('<p:b'), 2)
+      r.read
+      assert_equal 'b', r.name
+      assert_nil r.namespace_uri
+      assert_equal 'b', r.expanded_name
+    end
+  end
+
+  def test_byte_offset_streaming
+    r = FastXmlReader.new(StringIO.new('<a><bb>x</bb><c/></a>'), chunk_size: 2)
+    offsets = r.each.map(&:byte_offset)
+    assert_equal [0, 3, 7, 8, 13, 17], offsets
+  end
+
+  def test_seek_to_requires_mmap
+    assert_raises(IOError) { reader_for('<a/>').seek_to(0) }
+  end
+
+  def test_record_index_round_trip
+    idx_path = nil
+    with_records_file(300) do |path|
+      index = FastXmlReader::Index.build(path, 'record', 'id')
+      assert_equal 300, index.size
+      idx_path = "#{path}.fxri"
+      index.save(idx_path)
+
+      loaded = FastXmlReader::Index.load(idx_path)
+      assert loaded.fresh?(path)
+      assert_equal index['123'], loaded['123']
+
+      r = FastXmlReader.new(path)
+      assert_equal true, loaded.seek(r, '123')
+      assert_equal '123', r.attribute('id')
+      assert_equal({ 'id' => '123', 'name' => 'n123' }, r.read_subtree_hash)
+      assert_equal false, loaded.seek(r, 'missing')
+    end
+  ensure
+    File.unlink(idx_path) if idx_path && File.exist?(idx_path)
+  end
+
+  # ── Reuse across documents ──────────────────────────────────────────
+
+  def test_reset_reads_next_document_with_warm_cache
+    r = reader_for('<a><b/></a>')
+    assert_equal %w[a b a], r.each.map(&:name)
+    misses = r.cache_stats[:misses]
+
+    with_xml_file('<a><b>x</b></a>') do |path|
+      assert_same r, r.reset(path)
+      assert_equal %w[a b b a], r.each.map(&:name).compact
+    end
+    assert_equal misses, r.cache_stats[:misses]
+  end
+
+  def test_reset_switches_between_sources
+    with_xml_file('<big>' + '<i/>' * 20_000 + '</big>') do |big|
+      with_xml_file('<small k="v"/>') do |small|
+        r = FastXmlReader.new(StringIO.new('<s>1</s>'), chunk_size: 2)
+        r.read
+        r.reset(big)
+        assert_equal 20_002, r.each.count
+        r.reset(small)
+        r.read
+        assert_equal 'v', r.attribute('k')
+        r.reset(StringIO.new('<t>2</t>'))
+        r.read; r.read
+        assert_equal '2', r.value
+        r.reset(small)
+        assert_equal 1, r.each.count
+      end
+    end
+  end
+
+  def test_small_files_support_seek_and_split
+    with_records_file(10) do |path|
+      r = FastXmlReader.new(path)
+      r.each_element('record') { break if r.attribute('id') == '4' }
+      offset = r.byte_offset
+      r.seek_to(offset, 1)
+      r.read
+      assert_equal '4', r.attribute('id')
+      assert_equal 10, r.split_records('record', 3).inject(0) { |n, (o, l)| n + record_ids(path, o, l).size }
+    end
+  end
+
+  def test_each_file
+    with_xml_file('<a>1</a>') do |one|
+      with_xml_file('<b>2</b>') do |two|
+        seen = []
+        FastXmlReader.each_file([one, two]) do |r, path|
+          r.read; r.read
+          seen << [path, r.value]
+        end
+        assert_equal [[one, '1'], [two, '2']], seen
+        assert_kind_of Enumerator, FastXmlReader.each_file([one])
+      end
+    end
+  end
+
+  # ── Long scans (GVL released) ───────────────────────────────────────
+
+  def with_xml_file(xml)
+    file = Tempfile.new(['large', '.xml'])
+    file.write(xml)
+    file.close
+    yield file.path
+  ensure
+    file.unlink if file
+  end
+
+  def test_large_skipped_sections
+    filler = 'x-]?' * 300_000
+    xml = "<root><!-- #{filler} --><![CDATA[#{filler}]]><?pi #{filler} ?><a>#{filler}</a><b/></root>"
+    with_xml_file(xml) do |path|
+      nodes = nodes_from(FastXmlReader.new(path))
+      assert_equal %w[root a a b root], nodes.map { |n| n[:name] }.compact
+      assert_equal filler, nodes[2][:value]
+    end
+  end
+
+  def test_large_doctype_internal_subset
+    xml = "<!DOCTYPE r [#{'<!ENTITY e "v">' * 50_000}]><r>ok</r>"
+    with_xml_file(xml) do |path|
+      assert_equal [nil, 'ok', nil], nodes_from(FastXmlReader.new(path)).map { |n| n[:value] }
+    end
+  end
+
+  def test_each_element_across_long_gaps
+    xml = '<root><hit n="1"/>' + ('<miss a="1">t</miss>' * 40_000) + '<hit n="2"/>' + ('<miss/>' * 40_000) + '</root>'
+    with_xml_file(xml) do |path|
+      r = FastXmlReader.new(path)
+      assert_equal %w[1 2], r.each_element('hit').map { |n| n.attribute('n') }
+    end
+  end
+
+  def test_count_elements_across_long_gaps
+    xml = '<root>' + ('<hit n="1"/><miss a="1">t</miss>' * 40_000) + '</root>'
+    with_xml_file(xml) do |path|
+      assert_equal 40_000, FastXmlReader.new(path).count_elements('hit')
+      assert_equal '1', FastXmlReader.new(path).find_first('miss').attribute('a')
+    end
+  end
+
+  def test_reader_refuses_other_threads_during_gvl_free_scan
+    xml = '<r>' + ('<y a="1"><z>t</z></y>' * 1_000_000) + '</r>'
+    with_xml_file(xml) do |path|
+      r = FastXmlReader.new(path)
+      r.read
+      done = false
+      refused = 0
+      other = Thread.new do
+        until done
+          begin
+            r.attributes
+            r.depth
+          rescue IOError
+            refused += 1
+          end
+          Thread.pass
+        end
+      end
+      r.skip_subtree
+      done = true
+      other.join
+      assert_operator refused, :>, 0
+      assert_equal ['r', FastXmlReader::TYPE_END_ELEMENT, 0], [r.name, r.node_type, r.depth]
+    end
+  end
+
+  def test_mmap_hints_leave_results_unchanged
+    xml = '<root>' + ('<r id="1"><v>text &amp; more</v></r>' * 60_000) + '</root>'
+    with_xml_file(xml) do |path|
+      plain = nodes_from(FastXmlReader.new(path))
+      tuned = FastXmlReader.new(path, populate: true, huge_pages: true, readahead: 256 * 1024, drop_behind: true)
+      assert_equal plain, nodes_from(tuned)
+    end
+  end
+
+  def test_drop_behind_with_seek_to_and_skip
+    xml = '<root>' + ('<r><v>x</v></r>' * 200_000) + '<last/></root>'
+    with_xml_file(xml) do |path|
+      r = FastXmlReader.new(path, readahead: 64 * 1024, drop_behind: true)
+      r.read
+      r.read
+      offset = r.byte_offset
+      r.skip_subtree
+      assert_equal 'last', r.find_first('last').name
+      r.seek_to(offset, 1)
+      r.read
+      assert_equal 'r', r.name
+      r.read
+      assert_equal 'v', r.name
+    end
+  end
+
+  def test_readahead_must_not_be_negative
+    assert_raises(ArgumentError) { FastXmlReader.new(StringIO.new('<a/>'), readahead: -1) }
+  end
+
   # ── Resource management ─────────────────────────────────────────────
 
   def test_close_releases_resources
@@ -311,10 +1753,19 @@ class TestFastXmlReader < Minitest::Test
     assert_equal 3, FastXmlReader::TYPE_TEXT
   end
 
+  def test_type_cdata_constant
+    assert_equal 4, FastXmlReader::TYPE_CDATA
+  end
+
   def test_type_end_element_constant
     assert_equal 15, FastXmlReader::TYPE_END_ELEMENT
   end
 
+  def test_compression_formats_constant
+    assert FastXmlReader::COMPRESSION_FORMATS.frozen?
+    assert_empty FastXmlReader::COMPRESSION_FORMATS - %w[gzip zstd]
+  end
+
   # ── Integration: full document traversal ────────────────────────────
 
   def test_full_traversal